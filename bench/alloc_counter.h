@@ -0,0 +1,94 @@
+#pragma once
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include <cstddef>
+#include <openssl/crypto.h>
+
+/**
+ * Counts heap allocations made via operator new and via OpenSSL's allocator.<p>
+ * Replaces the global operator new/delete, so include this header in exactly one translation unit per benchmark executable,
+ * and call alloc_counter::install() before anything else touches OpenSSL (it can't swap the allocator afterwards).
+ */
+namespace alloc_counter
+{
+	/**
+	 * Allocation counts and sizes.
+	 */
+	struct counts
+	{
+		/// Calls to operator new.
+		size_t cpp_allocations = 0;
+
+		/// Bytes requested via operator new.
+		size_t cpp_bytes = 0;
+
+		/// Calls to OPENSSL_malloc/OPENSSL_realloc (and the functions using them).
+		size_t openssl_allocations = 0;
+
+		/// Bytes requested from OpenSSL's allocator.
+		size_t openssl_bytes = 0;
+
+		counts operator-(const counts& other) const
+		{
+			return { cpp_allocations - other.cpp_allocations, cpp_bytes - other.cpp_bytes, openssl_allocations - other.openssl_allocations, openssl_bytes - other.openssl_bytes };
+		}
+	};
+
+	inline std::atomic<size_t> cpp_allocations(0), cpp_bytes(0), openssl_allocations(0), openssl_bytes(0);
+
+	/**
+	 * Gets the allocations made so far (by all threads).
+	 */
+	inline counts now()
+	{
+		return { cpp_allocations.load(), cpp_bytes.load(), openssl_allocations.load(), openssl_bytes.load() };
+	}
+
+	/**
+	 * Routes OpenSSL's allocations through the counter.
+	 * @return Whether OpenSSL accepted the allocator (it doesn't once it allocated anything).
+	 */
+	inline bool install()
+	{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		return CRYPTO_set_mem_functions(
+			[](size_t n, const char*, int) -> void*
+			{
+				openssl_allocations++;
+				openssl_bytes += n;
+				return std::malloc(n);
+			},
+			[](void* p, size_t n, const char*, int) -> void*
+			{
+				openssl_allocations++;
+				openssl_bytes += n;
+				return std::realloc(p, n);
+			},
+			[](void* p, const char*, int) { std::free(p); }) == 1;
+#else
+		return false;
+#endif
+	}
+}
+
+void* operator new(size_t n)
+{
+	alloc_counter::cpp_allocations++;
+	alloc_counter::cpp_bytes += n;
+	if (void* p = std::malloc(n ? n : 1))
+	{
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
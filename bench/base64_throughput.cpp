@@ -0,0 +1,101 @@
+/*
+   Measures base64url encoding and decoding throughput (in input bytes per cycle) of the SIMD kernels and of the scalar
+   table path, for segment sizes typical for JWT headers, payloads and signatures.<p>
+   Usage: base64_throughput [BYTES_PER_MEASUREMENT]<p>
+   Cycles are read from the time stamp counter, which ticks at the CPU's nominal frequency: with frequency scaling,
+   compare the SIMD and scalar columns with each other rather than with cycle counts from other machines.
+*/
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include "jwt-cpp/base.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+using jwt::base;
+using jwt::alphabet::base64url;
+
+/**
+ * Same characters as base64url, but in another array, so jwt::base takes the scalar table path for it.
+ */
+struct scalar_base64url
+{
+	static const array<char, 64>& data()
+	{
+		static const array<char, 64> copy = base64url::data();
+		return copy;
+	}
+
+	static const string& fill()
+	{
+		return base64url::fill();
+	}
+};
+
+/**
+ * Gets a cycle count (or, on other architectures, nanoseconds).
+ */
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * Runs an operation repeatedly.
+ * @param input_size The amount of input bytes processed per call.
+ * @param total How many input bytes to process in total.
+ * @param f The operation.
+ * @return The input bytes per cycle.
+ */
+template <typename F>
+static double measure(size_t input_size, size_t total, F f)
+{
+	const size_t iterations = total / input_size + 1;
+	for (size_t i = 0; i < iterations / 10 + 1; i++)
+	{
+		f();
+	}
+
+	const uint64_t start = cycles();
+	for (size_t i = 0; i < iterations; i++)
+	{
+		f();
+	}
+	return (double)(input_size * iterations) / (double)(cycles() - start);
+}
+
+int main(int argc, char** argv)
+{
+	const size_t total = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200 * 1000 * 1000;
+
+	printf("%8s %14s %14s %14s %14s\n", "bytes", "encode SIMD", "encode scalar", "decode SIMD", "decode scalar");
+	for (size_t size : { 200, 300, 500, 750, 1000, 1500, 2000 })
+	{
+		string bin(size, '\0');
+		for (size_t i = 0; i < size; i++)
+		{
+			bin[i] = (char)(i * 167 + 13);
+		}
+		const string text = base::encode_unpadded<base64url>(bin);
+		vector<char> out(text.size() + 64);
+
+		// Throughput is per input byte: binary bytes for encoding, characters for decoding
+		const double encode_simd = measure(size, total, [&]() { base::encode_unpadded<base64url>(bin.data(), bin.size(), out.data()); });
+		const double encode_scalar = measure(size, total, [&]() { base::encode_unpadded<scalar_base64url>(bin.data(), bin.size(), out.data()); });
+		const double decode_simd = measure(text.size(), total, [&]() { base::decode_unpadded<base64url>(text.data(), text.size(), out.data()); });
+		const double decode_scalar = measure(text.size(), total, [&]() { base::decode_unpadded<scalar_base64url>(text.data(), text.size(), out.data()); });
+
+		printf("%8zu %14.2f %14.2f %14.2f %14.2f\n", size, encode_simd, encode_scalar, decode_simd, decode_scalar);
+	}
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+   Measures jwt::decode: tokens per second and heap allocations per token, for a small and a large token and for
+   three access patterns (decode only, decode and read one claim, decode and read every claim).<p>
+   Usage: decode_throughput [ITERATIONS]<p>
+   Only uses API that jwt::decode has always had, so the same source also builds against another jwt-cpp version
+   (see JWTGEN_BENCH_BASELINE_INCLUDE in bench/CMakeLists.txt) to compare against it.
+*/
+
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include "alloc_counter.h"
+#include "jwt-cpp/jwt.h"
+
+using namespace std;
+
+/**
+ * Encodes a token part (base64url without fill).
+ */
+static string encode_part(const string& data)
+{
+	string res = jwt::base::encode<jwt::alphabet::base64url>(data);
+	const string& fill = jwt::alphabet::base64url::fill();
+	while (res.size() >= fill.size() && res.compare(res.size() - fill.size(), fill.size(), fill) == 0)
+	{
+		res.erase(res.size() - fill.size());
+	}
+	return res;
+}
+
+/**
+ * Builds a token from its header and payload JSON and a dummy signature of the passed size (decoding doesn't verify it).
+ */
+static string make_token(const string& header, const string& payload, size_t signature_size)
+{
+	return encode_part(header) + "." + encode_part(payload) + "." + encode_part(string(signature_size, '\x5a'));
+}
+
+/**
+ * Decodes a token repeatedly and prints the throughput and the allocations per token.
+ * @param name Name of the measurement.
+ * @param token The token.
+ * @param iterations How many times to decode it.
+ * @param use What to do with the decoded token.
+ */
+static void measure(const char* name, const string& token, size_t iterations, const function<size_t(const jwt::decoded_jwt&)>& use)
+{
+	size_t sink = 0;
+	sink += use(jwt::decode(token));
+
+	const auto before = alloc_counter::now();
+	const auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++)
+	{
+		sink += use(jwt::decode(token));
+	}
+	const auto elapsed = chrono::steady_clock::now() - start;
+	const auto diff = alloc_counter::now() - before;
+
+	printf("%-24s %6zu %12.0f %10.1f %10.0f   (%zu)\n", name, token.size(),
+		iterations / chrono::duration<double>(elapsed).count(),
+		(double)diff.cpp_allocations / iterations, (double)diff.cpp_bytes / iterations, sink % 10);
+}
+
+int main(int argc, char** argv)
+{
+	const size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+
+	const string small = make_token(R"({"alg":"HS256","typ":"JWT"})",
+		R"({"aud":"api","exp":1700003600,"iat":1700000000,"iss":"auth.example.com","sub":"user-4711"})", 32);
+
+	string claims = R"({"aud":"api","exp":1700003600,"iat":1700000000,"iss":"auth.example.com","nbf":1700000000,"sub":"user-4711")";
+	for (int i = 1; i <= 25; i++)
+	{
+		claims += ",\"scope_" + to_string(i) + "\":\"read-write-admin-" + to_string(i) + "\"";
+	}
+	claims += ",\"roles\":[\"admin\",\"editor\",\"viewer\"],\"profile\":{\"name\":\"Jane Doe\",\"email\":\"jane@example.com\",\"verified\":true}}";
+	const string large = make_token(R"({"alg":"RS256","kid":"key-2024-01","typ":"JWT"})", claims, 256);
+
+	printf("%-24s %6s %12s %10s %10s\n", "", "bytes", "tokens/s", "allocs", "alloc B");
+	for (const auto& token : { make_pair("small", small), make_pair("large", large) })
+	{
+		measure((token.first + string(": decode")).c_str(), token.second, iterations, [](const jwt::decoded_jwt&) { return (size_t)0; });
+		measure((token.first + string(": decode + sub")).c_str(), token.second, iterations, [](const jwt::decoded_jwt& jwt) { return jwt.get_payload_claim("sub").as_string().size(); });
+		measure((token.first + string(": decode + all")).c_str(), token.second, iterations, [](const jwt::decoded_jwt& jwt) { return jwt.get_payload_claims().size(); });
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+   Measures time and heap allocations per sign and verify call of the RSA (RS*), RSA-PSS (PS*) and ECDSA (ES*) algorithms.<p>
+   Usage: sign_allocations [ITERATIONS] [PAYLOAD_SIZE]
+*/
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/rsa.h>
+#include "alloc_counter.h"
+#include "jwt-cpp/jwt.h"
+
+using namespace std;
+
+/**
+ * Generates a key pair.
+ * @param type EVP_PKEY_RSA or EVP_PKEY_EC.
+ * @param param The RSA modulus size in bits or the curve NID.
+ * @return The key pair.
+ */
+static shared_ptr<EVP_PKEY> generate_key(int type, int param)
+{
+	unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx(EVP_PKEY_CTX_new_id(type, nullptr), EVP_PKEY_CTX_free);
+	EVP_PKEY* key = nullptr;
+	if (!ctx || EVP_PKEY_keygen_init(ctx.get()) <= 0
+		|| (type == EVP_PKEY_RSA ? EVP_PKEY_CTX_set_rsa_keygen_bits(ctx.get(), param) : EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx.get(), param)) <= 0
+		|| EVP_PKEY_keygen(ctx.get(), &key) <= 0)
+	{
+		fprintf(stderr, "Key generation failed\n");
+		exit(1);
+	}
+	return shared_ptr<EVP_PKEY>(key, EVP_PKEY_free);
+}
+
+/**
+ * Runs an operation repeatedly and prints the average time and allocations per call.
+ * @param name The algorithm name.
+ * @param op "sign" or "verify".
+ * @param iterations How many times to run the operation.
+ * @param f The operation.
+ */
+static void measure(const string& name, const char* op, size_t iterations, const function<void()>& f)
+{
+	// The first call sets up the calling thread's contexts
+	f();
+
+	const auto before = alloc_counter::now();
+	const auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++)
+	{
+		f();
+	}
+	const auto elapsed = chrono::steady_clock::now() - start;
+	const auto diff = alloc_counter::now() - before;
+
+	printf("%-6s %-6s %10.0f %10.1f %10.0f %10.1f %10.0f\n", name.c_str(), op,
+		chrono::duration<double, nano>(elapsed).count() / iterations,
+		(double)diff.cpp_allocations / iterations, (double)diff.cpp_bytes / iterations,
+		(double)diff.openssl_allocations / iterations, (double)diff.openssl_bytes / iterations);
+}
+
+/**
+ * Measures signing and verifying with an algorithm.
+ * @param alg The algorithm (set up with a private key).
+ * @param iterations How many tokens to sign and verify.
+ * @param data The signing input.
+ */
+template <typename T>
+static void measure_algorithm(const T& alg, size_t iterations, const string& data)
+{
+	const string signature = alg.sign(data);
+	measure(alg.name(), "sign", iterations, [&]() { alg.sign(data); });
+	measure(alg.name(), "verify", iterations, [&]() { alg.verify(data, signature); });
+}
+
+int main(int argc, char** argv)
+{
+	// Must happen before OpenSSL allocates anything
+	if (!alloc_counter::install())
+	{
+		fprintf(stderr, "Couldn't hook OpenSSL's allocator: OpenSSL allocations will show up as 0\n");
+	}
+
+	const size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+	const size_t payload_size = argc > 2 ? strtoul(argv[2], nullptr, 10) : 300;
+	const string data(payload_size, 'x');
+
+	const auto rsa_key = generate_key(EVP_PKEY_RSA, 2048);
+	const auto p256 = generate_key(EVP_PKEY_EC, NID_X9_62_prime256v1);
+	const auto p384 = generate_key(EVP_PKEY_EC, NID_secp384r1);
+	const auto p521 = generate_key(EVP_PKEY_EC, NID_secp521r1);
+
+	printf("%zu iterations, %zu byte signing input, per call:\n", iterations, payload_size);
+	printf("%-6s %-6s %10s %10s %10s %10s %10s\n", "alg", "op", "ns", "new", "new B", "ossl", "ossl B");
+
+	measure_algorithm(jwt::algorithm::rs256(rsa_key), iterations, data);
+	measure_algorithm(jwt::algorithm::rs384(rsa_key), iterations, data);
+	measure_algorithm(jwt::algorithm::rs512(rsa_key), iterations, data);
+	measure_algorithm(jwt::algorithm::ps256(rsa_key), iterations, data);
+	measure_algorithm(jwt::algorithm::ps384(rsa_key), iterations, data);
+	measure_algorithm(jwt::algorithm::ps512(rsa_key), iterations, data);
+	measure_algorithm(jwt::algorithm::es256(p256), iterations, data);
+	measure_algorithm(jwt::algorithm::es384(p384), iterations, data);
+	measure_algorithm(jwt::algorithm::es512(p521), iterations, data);
+	return 0;
+}
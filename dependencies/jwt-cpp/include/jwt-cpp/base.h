@@ -1,6 +1,14 @@
 #pragma once
 #include <string>
 #include <array>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define JWT_BASE_X86_SIMD
+#include <immintrin.h>
+#endif
 
 namespace jwt {
 	namespace alphabet {
@@ -38,35 +46,270 @@ namespace jwt {
 	public:
 		template<typename T>
 		static std::string encode(const std::string& bin) {
-			return encode(bin, T::data(), T::fill());
+			std::string res(encoded_size<T>(bin.size()), '\0');
+			encode(bin.data(), bin.size(), &res[0], T::data(), T::fill());
+			return res;
+		}
+		// Exact amount of characters encode<T> produces for size bytes
+		template<typename T>
+		static size_t encoded_size(size_t size) {
+			return encoded_size(size, T::fill());
+		}
+		// Encodes size bytes into out, which must hold at least encoded_size<T>(size) characters; returns the amount written
+		template<typename T>
+		static size_t encode(const char* bin, size_t size, char* out) {
+			return encode(bin, size, out, T::data(), T::fill());
 		}
 		template<typename T>
 		static std::string decode(const std::string& base) {
-			return decode(base, T::data(), T::fill());
+			return decode(base, T::data(), T::fill(), decode_table<T>());
+		}
+
+		// Same as encode, but without fill (as required by JWT, see RFC 7515 section 2)
+		template<typename T>
+		static std::string encode_unpadded(const std::string& bin) {
+			std::string res(encoded_size_unpadded<T>(bin.size()), '\0');
+			encode(bin.data(), bin.size(), &res[0], T::data(), no_fill());
+			return res;
+		}
+		template<typename T>
+		static size_t encoded_size_unpadded(size_t size) {
+			return encoded_size(size, no_fill());
+		}
+		template<typename T>
+		static size_t encode_unpadded(const char* bin, size_t size, char* out) {
+			return encode(bin, size, out, T::data(), no_fill());
+		}
+		// Decodes input without fill; fill characters are invalid input, like any other character outside the alphabet
+		template<typename T>
+		static std::string decode_unpadded(const std::string& base) {
+			std::string res(decoded_size_unpadded<T>(base.size()), '\0');
+			decode_unpadded<T>(base.data(), base.size(), &res[0]);
+			return res;
+		}
+		// Exact amount of bytes decode_unpadded<T> produces for size characters (if they are valid input)
+		template<typename T>
+		static size_t decoded_size_unpadded(size_t size) {
+			return size / 4 * 3 + (size % 4 > 1 ? size % 4 - 1 : 0);
+		}
+		// Decodes size characters into out, which must hold at least decoded_size_unpadded<T>(size) bytes; returns the amount written
+		template<typename T>
+		static size_t decode_unpadded(const char* base, size_t size, char* out) {
+			if (size % 4 == 1)
+				throw std::runtime_error("Invalid input");
+			return decode(base, size, (4 - size % 4) % 4, T::data(), decode_table<T>(), out);
 		}
 
 	private:
-		static std::string encode(const std::string& bin, const std::array<char, 64>& alphabet, const std::string& fill) {
-			size_t size = bin.size();
-			std::string res;
+		static const std::string& no_fill() {
+			static const std::string fill;
+			return fill;
+		}
+
+		// Maps every byte to its sextet, or to -1 if it's not part of the alphabet
+		typedef std::array<int8_t, 256> sextet_table;
+
+		template<typename T>
+		static const sextet_table& decode_table() {
+			static const sextet_table table = make_decode_table(T::data());
+			return table;
+		}
+
+		static sextet_table make_decode_table(const std::array<char, 64>& alphabet) {
+			sextet_table table;
+			table.fill(-1);
+			for (size_t i = 0; i < alphabet.size(); i++)
+				table[(unsigned char)alphabet[i]] = (int8_t)i;
+			return table;
+		}
+
+#ifdef JWT_BASE_X86_SIMD
+		/*
+		 * Lookup tables for decoding 16 or 32 characters at once (see Wojciech Mula, "Base64 decoding with SIMD
+		 * instructions"). A character is valid if lo[its low nibble] & hi[its high nibble] is zero; its sextet is the
+		 * character plus roll[its high nibble], except for the one character that shares the high nibble with a range
+		 * but needs another offset: its roll index is the high nibble XOR special_xor.
+		 * Encoding goes the other way: sextets are reduced to a range index (0 = a-z, 1-10 = 0-9, 11 and 12 = the last
+		 * two characters, 13 = A-Z) and shift[range index] is added.
+		 */
+		struct simd_tables {
+			int8_t lo[16];
+			int8_t hi[16];
+			int8_t roll[16];
+			char special;
+			int8_t special_xor;
+			int8_t shift[16];
+		};
+
+		static const simd_tables* get_simd_tables(const std::array<char, 64>& alphabet) {
+			static const simd_tables base64 = {
+				{ 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A },
+				{ 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 },
+				{ 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0 },
+				'/', 0x03,
+				{ 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0 }
+			};
+			static const simd_tables base64url = {
+				{ 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x3B, 0x3B, 0x3A, 0x3B, 0x33 },
+				{ 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x20, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 },
+				{ 0, 0, 17, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, -32, 0, 0 },
+				'_', 0x08,
+				{ 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0 }
+			};
+			if (&alphabet == &jwt::alphabet::base64::data())
+				return &base64;
+			if (&alphabet == &jwt::alphabet::base64url::data())
+				return &base64url;
+			return nullptr;
+		}
+
+		enum class simd_level { none, ssse3, sse41, avx2 };
+
+		static simd_level get_simd_level() {
+			static const simd_level level = __builtin_cpu_supports("avx2") ? simd_level::avx2
+				: __builtin_cpu_supports("sse4.1") ? simd_level::sse41
+				: __builtin_cpu_supports("ssse3") ? simd_level::ssse3 : simd_level::none;
+			return level;
+		}
+
+		// Encodes blocks of 12 bytes (reading 16) into 16 characters. Returns the amount of bytes consumed.
+		__attribute__((target("ssse3")))
+		static size_t encode_ssse3(const char* in, size_t size, char* out, const simd_tables& t) {
+			const __m128i lut_shift = _mm_loadu_si128((const __m128i*)t.shift);
+			const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+
+			size_t i = 0;
+			for (; i + 16 <= size; i += 12, out += 16) {
+				// Every 32 bit lane gets one triple as bbbbcccc ccdddddd aaaaaabb bbbbcccc, then the sextets are moved into their own bytes
+				const __m128i triples = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + i)), spread);
+				const __m128i ac = _mm_mulhi_epu16(_mm_and_si128(triples, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+				const __m128i bd = _mm_mullo_epi16(_mm_and_si128(triples, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+				const __m128i sextets = _mm_or_si128(ac, bd);
+				__m128i range = _mm_subs_epu8(sextets, _mm_set1_epi8(51));
+				range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), sextets), _mm_set1_epi8(13)));
+				_mm_storeu_si128((__m128i*)out, _mm_add_epi8(sextets, _mm_shuffle_epi8(lut_shift, range)));
+			}
+			return i;
+		}
+
+		// Same as encode_ssse3, but for blocks of 24 bytes (reading 28) into 32 characters
+		__attribute__((target("avx2")))
+		static size_t encode_avx2(const char* in, size_t size, char* out, const simd_tables& t) {
+			const __m256i lut_shift = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.shift));
+			const __m256i spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+				1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+
+			size_t i = 0;
+			for (; i + 28 <= size; i += 24, out += 32) {
+				const __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(in + i))),
+					_mm_loadu_si128((const __m128i*)(in + i + 12)), 1);
+				const __m256i triples = _mm256_shuffle_epi8(bytes, spread);
+				const __m256i ac = _mm256_mulhi_epu16(_mm256_and_si256(triples, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+				const __m256i bd = _mm256_mullo_epi16(_mm256_and_si256(triples, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+				const __m256i sextets = _mm256_or_si256(ac, bd);
+				__m256i range = _mm256_subs_epu8(sextets, _mm256_set1_epi8(51));
+				range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), sextets), _mm256_set1_epi8(13)));
+				_mm256_storeu_si256((__m256i*)out, _mm256_add_epi8(sextets, _mm256_shuffle_epi8(lut_shift, range)));
+			}
+			return i;
+		}
+
+		// Decodes blocks of 16 characters into 12 bytes (writing 16); stops before the first block with an invalid character.
+		// Returns the amount of characters consumed.
+		__attribute__((target("sse4.1")))
+		static size_t decode_sse41(const char* in, size_t size, char* out, const simd_tables& t) {
+			const __m128i lut_lo = _mm_loadu_si128((const __m128i*)t.lo);
+			const __m128i lut_hi = _mm_loadu_si128((const __m128i*)t.hi);
+			const __m128i lut_roll = _mm_loadu_si128((const __m128i*)t.roll);
+			const __m128i nibble = _mm_set1_epi8(0x0F);
+			const __m128i special = _mm_set1_epi8(t.special);
+			const __m128i special_xor = _mm_set1_epi8(t.special_xor);
+			const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+			size_t i = 0;
+			for (; i + 16 <= size; i += 16, out += 12) {
+				const __m128i chars = _mm_loadu_si128((const __m128i*)(in + i));
+				const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(chars, 4), nibble);
+				const __m128i lo_nibbles = _mm_and_si128(chars, nibble);
+				if (!_mm_testz_si128(_mm_shuffle_epi8(lut_lo, lo_nibbles), _mm_shuffle_epi8(lut_hi, hi_nibbles)))
+					break;
+				const __m128i index = _mm_xor_si128(hi_nibbles, _mm_and_si128(_mm_cmpeq_epi8(chars, special), special_xor));
+				const __m128i sextets = _mm_add_epi8(chars, _mm_shuffle_epi8(lut_roll, index));
+				// aaaaaabb bbbbcccc ccdddddd in the low 3 bytes of every 32 bit lane (big endian), then compacted
+				const __m128i pairs = _mm_maddubs_epi16(sextets, _mm_set1_epi32(0x01400140));
+				const __m128i triples = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+				_mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(triples, pack));
+			}
+			return i;
+		}
+
+		// Same as decode_sse41, but for blocks of 32 characters into 24 bytes (writing 32)
+		__attribute__((target("avx2")))
+		static size_t decode_avx2(const char* in, size_t size, char* out, const simd_tables& t) {
+			const __m256i lut_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.lo));
+			const __m256i lut_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.hi));
+			const __m256i lut_roll = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.roll));
+			const __m256i nibble = _mm256_set1_epi8(0x0F);
+			const __m256i special = _mm256_set1_epi8(t.special);
+			const __m256i special_xor = _mm256_set1_epi8(t.special_xor);
+			const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+				2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+			const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+			size_t i = 0;
+			for (; i + 32 <= size; i += 32, out += 24) {
+				const __m256i chars = _mm256_loadu_si256((const __m256i*)(in + i));
+				const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(chars, 4), nibble);
+				const __m256i lo_nibbles = _mm256_and_si256(chars, nibble);
+				if (!_mm256_testz_si256(_mm256_shuffle_epi8(lut_lo, lo_nibbles), _mm256_shuffle_epi8(lut_hi, hi_nibbles)))
+					break;
+				const __m256i index = _mm256_xor_si256(hi_nibbles, _mm256_and_si256(_mm256_cmpeq_epi8(chars, special), special_xor));
+				const __m256i sextets = _mm256_add_epi8(chars, _mm256_shuffle_epi8(lut_roll, index));
+				const __m256i pairs = _mm256_maddubs_epi16(sextets, _mm256_set1_epi32(0x01400140));
+				const __m256i triples = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+				const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(triples, pack), lanes);
+				_mm256_storeu_si256((__m256i*)out, packed);
+			}
+			return i;
+		}
+#endif
+
+		static size_t encoded_size(size_t size, const std::string& fill) {
+			const size_t mod = size % 3;
+			return size / 3 * 4 + (mod == 0 ? 0 : mod + 1 + (3 - mod) * fill.size());
+		}
+
+		static size_t encode(const char* bin, size_t size, char* out, const std::array<char, 64>& alphabet, const std::string& fill) {
+			char* const begin = out;
+			size_t i = 0;
+#ifdef JWT_BASE_X86_SIMD
+			if (const simd_tables* tables = get_simd_tables(alphabet)) {
+				const simd_level level = get_simd_level();
+				if (level == simd_level::avx2)
+					i = encode_avx2(bin, size, out, *tables);
+				if (level >= simd_level::ssse3)
+					i += encode_ssse3(bin + i, size - i, out + i / 3 * 4, *tables);
+				out += i / 3 * 4;
+			}
+#endif
 
 			// clear incomplete bytes
 			size_t fast_size = size - size % 3;
-			for (size_t i = 0; i < fast_size;) {
-				uint32_t octet_a = (unsigned char)bin[i++];
-				uint32_t octet_b = (unsigned char)bin[i++];
-				uint32_t octet_c = (unsigned char)bin[i++];
+			for (; i < fast_size; i += 3) {
+				uint32_t octet_a = (unsigned char)bin[i];
+				uint32_t octet_b = (unsigned char)bin[i + 1];
+				uint32_t octet_c = (unsigned char)bin[i + 2];
 
 				uint32_t triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
 
-				res += alphabet[(triple >> 3 * 6) & 0x3F];
-				res += alphabet[(triple >> 2 * 6) & 0x3F];
-				res += alphabet[(triple >> 1 * 6) & 0x3F];
-				res += alphabet[(triple >> 0 * 6) & 0x3F];
+				*out++ = alphabet[(triple >> 3 * 6) & 0x3F];
+				*out++ = alphabet[(triple >> 2 * 6) & 0x3F];
+				*out++ = alphabet[(triple >> 1 * 6) & 0x3F];
+				*out++ = alphabet[(triple >> 0 * 6) & 0x3F];
 			}
 
 			if (fast_size == size)
-				return res;
+				return out - begin;
 
 			size_t mod = size % 3;
 
@@ -76,32 +319,36 @@ namespace jwt {
 
 			uint32_t triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
 
+			auto append_fill = [&]() {
+				out = std::copy(fill.begin(), fill.end(), out);
+			};
+
 			switch (mod) {
 			case 1:
-				res += alphabet[(triple >> 3 * 6) & 0x3F];
-				res += alphabet[(triple >> 2 * 6) & 0x3F];
-				res += fill;
-				res += fill;
+				*out++ = alphabet[(triple >> 3 * 6) & 0x3F];
+				*out++ = alphabet[(triple >> 2 * 6) & 0x3F];
+				append_fill();
+				append_fill();
 				break;
 			case 2:
-				res += alphabet[(triple >> 3 * 6) & 0x3F];
-				res += alphabet[(triple >> 2 * 6) & 0x3F];
-				res += alphabet[(triple >> 1 * 6) & 0x3F];
-				res += fill;
+				*out++ = alphabet[(triple >> 3 * 6) & 0x3F];
+				*out++ = alphabet[(triple >> 2 * 6) & 0x3F];
+				*out++ = alphabet[(triple >> 1 * 6) & 0x3F];
+				append_fill();
 				break;
 			default:
 				break;
 			}
 
-			return res;
+			return out - begin;
 		}
 
-		static std::string decode(const std::string& base, const std::array<char, 64>& alphabet, const std::string& fill) {
+		static std::string decode(const std::string& base, const std::array<char, 64>& alphabet, const std::string& fill, const sextet_table& table) {
 			size_t size = base.size();
 
 			size_t fill_cnt = 0;
 			while (size > fill.size()) {
-				if (base.substr(size - fill.size(), fill.size()) == fill) {
+				if (base.compare(size - fill.size(), fill.size(), fill) == 0) {
 					fill_cnt++;
 					size -= fill.size();
 					if(fill_cnt > 2)
@@ -113,56 +360,73 @@ namespace jwt {
 			if ((size + fill_cnt) % 4 != 0)
 				throw std::runtime_error("Invalid input");
 
-			size_t out_size = size / 4 * 3;
-			std::string res;
-			res.reserve(out_size);
+			std::string res(size / 4 * 3 + (fill_cnt == 0 ? 0 : 3 - fill_cnt), '\0');
+			decode(base.data(), size, fill_cnt, alphabet, table, &res[0]);
+			return res;
+		}
+
+		// Decodes size characters (without fill) into out; fill_cnt is the amount of missing characters in the last quadruple.
+		// Writes exactly size / 4 * 3 + (3 - fill_cnt) % 3 bytes and returns that amount.
+		static size_t decode(const char* base, size_t size, size_t fill_cnt, const std::array<char, 64>& alphabet, const sextet_table& table, char* out) {
+			char* const begin = out;
+			size_t fast_size = size - size % 4;
+			size_t out_size = fast_size / 4 * 3 + (fill_cnt == 0 ? 0 : 3 - fill_cnt);
 
 			auto get_sextet = [&](size_t offset) {
-				for (size_t i = 0; i < alphabet.size(); i++) {
-					if (alphabet[i] == base[offset])
-						return i;
-				}
-				throw std::runtime_error("Invalid input");
+				const int8_t sextet = table[(unsigned char)base[offset]];
+				if (sextet < 0)
+					throw std::runtime_error("Invalid input");
+				return (uint32_t)sextet;
 			};
 
-			
-			size_t fast_size = size - size % 4;
-			for (size_t i = 0; i < fast_size;) {
-				uint32_t sextet_a = get_sextet(i++);
-				uint32_t sextet_b = get_sextet(i++);
-				uint32_t sextet_c = get_sextet(i++);
-				uint32_t sextet_d = get_sextet(i++);
-
-				uint32_t triple = (sextet_a << 3 * 6)
-					+ (sextet_b << 2 * 6)
-					+ (sextet_c << 1 * 6)
-					+ (sextet_d << 0 * 6);
-
-				res += (triple >> 2 * 8) & 0xFF;
-				res += (triple >> 1 * 8) & 0xFF;
-				res += (triple >> 0 * 8) & 0xFF;
+			size_t i = 0;
+#ifdef JWT_BASE_X86_SIMD
+			if (const simd_tables* tables = get_simd_tables(alphabet)) {
+				// The kernels store a full vector per block (4 or 8 bytes past the block's output), so they stop early enough to stay within out_size
+				auto limit = [&](size_t vector_size) {
+					const size_t available = out_size - i / 4 * 3;
+					return available < vector_size ? 0 : std::min(fast_size - i, (available - vector_size) / 3 * 4 + vector_size);
+				};
+				const simd_level level = get_simd_level();
+				if (level == simd_level::avx2)
+					i = decode_avx2(base, limit(32), out, *tables);
+				if (level >= simd_level::sse41)
+					i += decode_sse41(base + i, limit(16), out + i / 4 * 3, *tables);
+				out += i / 4 * 3;
 			}
+#else
+			(void)alphabet;
+#endif
+			for (; i < fast_size; i += 4) {
+				uint32_t triple = (get_sextet(i) << 3 * 6)
+					+ (get_sextet(i + 1) << 2 * 6)
+					+ (get_sextet(i + 2) << 1 * 6)
+					+ (get_sextet(i + 3) << 0 * 6);
 
-			if (fill_cnt == 0)
-				return res;
+				*out++ = (char)((triple >> 2 * 8) & 0xFF);
+				*out++ = (char)((triple >> 1 * 8) & 0xFF);
+				*out++ = (char)((triple >> 0 * 8) & 0xFF);
+			}
 
-			uint32_t triple = (get_sextet(fast_size) << 3 * 6)
-				+ (get_sextet(fast_size + 1) << 2 * 6);
+			if (fill_cnt != 0) {
+				uint32_t triple = (get_sextet(fast_size) << 3 * 6)
+					+ (get_sextet(fast_size + 1) << 2 * 6);
 
-			switch (fill_cnt) {
-			case 1:
-				triple |= (get_sextet(fast_size + 2) << 1 * 6);
-				res += (triple >> 2 * 8) & 0xFF;
-				res += (triple >> 1 * 8) & 0xFF;
-				break;
-			case 2:
-				res += (triple >> 2 * 8) & 0xFF;
-				break;
-			default:
-				break;
+				switch (fill_cnt) {
+				case 1:
+					triple |= (get_sextet(fast_size + 2) << 1 * 6);
+					*out++ = (char)((triple >> 2 * 8) & 0xFF);
+					*out++ = (char)((triple >> 1 * 8) & 0xFF);
+					break;
+				case 2:
+					*out++ = (char)((triple >> 2 * 8) & 0xFF);
+					break;
+				default:
+					break;
+				}
 			}
 
-			return res;
+			return out - begin;
 		}
 	};
 }
@@ -0,0 +1,369 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <iostream>
+#include <condition_variable>
+#include "jwt-cpp/jwt.h"
+#include "signer.h"
+
+namespace batch {
+	/**
+	 * Amount of NDJSON lines that are handed to a worker thread at once.
+	 */
+	constexpr size_t chunk_size = 256;
+
+	/**
+	 * Outcome of processing a single NDJSON line.
+	 */
+	enum class line_result
+	{
+		BLANK,
+		SIGNED,
+		FAILED,
+	};
+
+	/**
+	 * Applies the claims of a JSON object (one NDJSON line) on top of a copy of the prototype token.
+	 * @param prototype The token holding the default claims (from the command line arguments).
+	 * @param line The JSON object containing the token's payload claims.
+	 * @param out_token Where to write the resulting token to.
+	 * @param out_error If the line couldn't be parsed, the reason is written into this.
+	 * @return Whether the line was a valid JSON object or not.
+	 */
+	inline bool parse_line(const jwt::builder& prototype, const std::string& line, jwt::builder& out_token, std::string& out_error)
+	{
+		picojson::value json;
+		out_error = picojson::parse(json, line);
+		if (!out_error.empty())
+		{
+			return false;
+		}
+
+		if (!json.is<picojson::object>())
+		{
+			out_error = "Line is not a JSON object.";
+			return false;
+		}
+
+		out_token = prototype;
+		for (const auto& claim : json.get<picojson::object>())
+		{
+			out_token.set_payload_claim(claim.first, jwt::claim(claim.second));
+		}
+
+		return true;
+	}
+
+	/**
+	 * Turns one NDJSON line into a signed token.
+	 * @param alg The algorithm to sign the token with.
+	 * @param prototype The token holding the default claims.
+	 * @param line The NDJSON line. This is overwritten with the signed token (or an empty string if the line was blank or invalid).
+	 * @param token Scratch builder instance (reused across lines).
+	 * @param out_error If the line couldn't be signed, the reason is written into this.
+	 * @return The outcome of the signing operation.
+	 */
+	inline line_result process_line(const signer::algorithm& alg, const jwt::builder& prototype, std::string& line, jwt::builder& token, std::string& out_error)
+	{
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+		{
+			line.clear();
+			return line_result::BLANK;
+		}
+
+		if (!parse_line(prototype, line, token, out_error))
+		{
+			out_error = "Invalid claims: " + out_error;
+			line.clear();
+			return line_result::FAILED;
+		}
+
+		try
+		{
+			line = alg.sign(token);
+			return line_result::SIGNED;
+		}
+		catch (const std::exception& e)
+		{
+			out_error = std::string("Failed to sign the token: ") + e.what();
+			line.clear();
+			return line_result::FAILED;
+		}
+	}
+
+	/**
+	 * Batch signing statistics.
+	 */
+	struct stats
+	{
+		size_t signed_count = 0;
+		size_t failed_count = 0;
+	};
+
+	/**
+	 * Signs all lines on the calling thread.
+	 */
+	inline void run_sequential(const jwt::builder& prototype, const signer::algorithm& alg, std::istream& in, std::ostream& out, stats& out_stats)
+	{
+		size_t line_number = 0;
+		std::string line, error;
+		jwt::builder token = prototype;
+
+		while (std::getline(in, line))
+		{
+			++line_number;
+
+			switch (process_line(alg, prototype, line, token, error))
+			{
+				case line_result::SIGNED:
+					++out_stats.signed_count;
+					break;
+				case line_result::FAILED:
+					std::cerr << "ERROR: Line " << line_number << ": " << error << '\n';
+					++out_stats.failed_count;
+					break;
+				default:
+					break;
+			}
+
+			out << line << '\n';
+		}
+	}
+
+	/**
+	 * A contiguous block of NDJSON lines that is signed by one worker thread.
+	 */
+	struct chunk
+	{
+		/// Line number of the chunk's first line (1-based).
+		size_t first_line = 0;
+
+		/// The input lines; these are replaced with the signed tokens in-place.
+		std::vector<std::string> lines;
+
+		/// Error message for each line (empty if the line was signed successfully or blank).
+		std::vector<std::string> errors;
+
+		stats chunk_stats;
+		bool done = false;
+	};
+
+	/**
+	 * Fans the lines out to a pool of worker threads (each one with its own algorithm instance) and writes the tokens in input order.<p>
+	 * The main thread reads chunks of lines, hands them to the workers and writes the oldest chunk as soon as it's done,
+	 * so that output line i always corresponds to input line i.
+	 */
+	inline void run_parallel(const jwt::builder& prototype, std::vector<std::unique_ptr<signer::algorithm>> algorithms, std::istream& in, std::ostream& out, stats& out_stats)
+	{
+		std::mutex mutex;
+		std::condition_variable work_available, chunk_done;
+		std::deque<std::shared_ptr<chunk>> pending, in_flight;
+		bool eof = false;
+
+		const size_t max_in_flight = algorithms.size() * 4;
+
+		auto worker = [&](std::unique_ptr<signer::algorithm> alg)
+		{
+			jwt::builder token = prototype;
+			for (;;)
+			{
+				std::shared_ptr<chunk> c;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					work_available.wait(lock, [&] { return eof || !pending.empty(); });
+					if (pending.empty())
+					{
+						return;
+					}
+					c = pending.front();
+					pending.pop_front();
+				}
+
+				for (size_t i = 0; i < c->lines.size(); ++i)
+				{
+					switch (process_line(*alg, prototype, c->lines[i], token, c->errors[i]))
+					{
+						case line_result::SIGNED:
+							++c->chunk_stats.signed_count;
+							break;
+						case line_result::FAILED:
+							++c->chunk_stats.failed_count;
+							break;
+						default:
+							break;
+					}
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					c->done = true;
+				}
+				chunk_done.notify_all();
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (auto& alg : algorithms)
+		{
+			workers.emplace_back(worker, std::move(alg));
+		}
+
+		auto write_chunk = [&](const chunk& c)
+		{
+			for (size_t i = 0; i < c.lines.size(); ++i)
+			{
+				if (!c.errors[i].empty())
+				{
+					std::cerr << "ERROR: Line " << c.first_line + i << ": " << c.errors[i] << '\n';
+				}
+				out << c.lines[i] << '\n';
+			}
+			out_stats.signed_count += c.chunk_stats.signed_count;
+			out_stats.failed_count += c.chunk_stats.failed_count;
+		};
+
+		// Waits for the oldest in-flight chunk to complete and writes it out.
+		auto flush_oldest = [&]
+		{
+			std::shared_ptr<chunk> c;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				chunk_done.wait(lock, [&] { return in_flight.front()->done; });
+				c = in_flight.front();
+				in_flight.pop_front();
+			}
+			write_chunk(*c);
+		};
+
+		size_t line_number = 1;
+		while (in)
+		{
+			auto c = std::make_shared<chunk>();
+			c->first_line = line_number;
+			c->lines.reserve(chunk_size);
+
+			std::string line;
+			while (c->lines.size() < chunk_size && std::getline(in, line))
+			{
+				c->lines.push_back(std::move(line));
+			}
+
+			if (c->lines.empty())
+			{
+				break;
+			}
+
+			line_number += c->lines.size();
+			c->errors.resize(c->lines.size());
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending.push_back(c);
+				in_flight.push_back(c);
+			}
+			work_available.notify_one();
+
+			if (in_flight.size() >= max_in_flight)
+			{
+				flush_oldest();
+			}
+		}
+
+		while (!in_flight.empty())
+		{
+			flush_oldest();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			eof = true;
+		}
+		work_available.notify_all();
+
+		for (auto& t : workers)
+		{
+			t.join();
+		}
+	}
+
+	/**
+	 * Reads newline-delimited JSON claim objects from the passed input stream and writes one signed token per line to the output stream.<p>
+	 * Output line i always corresponds to input line i: blank or invalid input lines result in an empty output line (errors are reported to stderr).
+	 * @param prototype The token holding the default claims; every line's claims are applied on top of a copy of it.
+	 * @param factory The factory used for creating the signing algorithm (one instance per worker thread).
+	 * @param thread_count The amount of worker threads to sign with (1 signs everything on the calling thread).
+	 * @param in The NDJSON input stream.
+	 * @param out Where to write the tokens to.
+	 * @return 0 if all tokens were signed successfully; 2 if one or more lines couldn't be signed.
+	 */
+	inline int run(const jwt::builder& prototype, const signer::factory& factory, size_t thread_count, std::istream& in, std::ostream& out)
+	{
+		using std::chrono::steady_clock;
+
+		const auto start = steady_clock::now();
+
+		thread_count = std::max<size_t>(thread_count, 1);
+
+		// Create all algorithm instances up-front so that key loading errors surface before any output is written.
+		std::vector<std::unique_ptr<signer::algorithm>> algorithms;
+		for (size_t i = 0; i < thread_count; ++i)
+		{
+			algorithms.push_back(factory());
+		}
+
+		stats s;
+		const std::string alg_name = algorithms.front()->name();
+
+		// Encode the header once; every line's token is a copy of the prototype and reuses it (lines only set payload claims).
+		jwt::builder primed = prototype;
+		primed.prepare_header(alg_name);
+
+		if (thread_count == 1)
+		{
+			run_sequential(primed, *algorithms.front(), in, out, s);
+		}
+		else
+		{
+			run_parallel(primed, std::move(algorithms), in, out, s);
+		}
+
+		out.flush();
+
+		const double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+		std::cerr << "Signed " << s.signed_count << " tokens (" << s.failed_count << " failed) using " << alg_name << " on " << thread_count << " thread(s) in " << seconds << " s (" << static_cast<size_t>(seconds > 0 ? s.signed_count / seconds : 0) << " tokens/sec)" << std::endl;
+
+		return s.failed_count == 0 ? 0 : 2;
+	}
+
+	/**
+	 * Runs a batch signing job, reading the NDJSON claims from the passed file path (or stdin if the path is null, empty or "-").
+	 * @param prototype The token holding the default claims; every line's claims are applied on top of a copy of it.
+	 * @param factory The factory used for creating the signing algorithm.
+	 * @param thread_count The amount of worker threads to sign with.
+	 * @param path The NDJSON input file path (or null/"-" for stdin).
+	 * @return 0 if all tokens were signed successfully; 2 if the input file couldn't be opened or one or more lines couldn't be signed.
+	 */
+	inline int run(const jwt::builder& prototype, const signer::factory& factory, size_t thread_count, const char* path)
+	{
+		std::ios::sync_with_stdio(false);
+
+		if (path == nullptr || *path == '\0' || std::string(path) == "-")
+		{
+			return run(prototype, factory, thread_count, std::cin, std::cout);
+		}
+
+		std::ifstream file(path);
+		if (!file.good())
+		{
+			std::cerr << "ERROR: The specified batch input file does not exist or couldn't be read: " << path << std::endl;
+			return 2;
+		}
+
+		return run(prototype, factory, thread_count, file, std::cout);
+	}
+}
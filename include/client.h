@@ -0,0 +1,143 @@
+#pragma once
+#include <string>
+#include "protocol.h"
+
+#if __linux__
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#endif
+
+namespace client {
+	/**
+	 * How long to wait for the signing daemon's response before giving up (in seconds).
+	 */
+	constexpr long timeout_seconds = 5;
+
+#if __linux__
+	/**
+	 * Sends a sign request to the signing daemon listening on the passed Unix domain socket and waits for its response.
+	 * @param socket_path The daemon's socket path.
+	 * @param request The request frame body (see protocol.h).
+	 * @param out_token Where to write the signed token to.
+	 * @param out_error If the request failed, the reason is written into this.
+	 * @param out_answered Set to whether the daemon answered at all (false if it couldn't be reached or broke the connection).
+	 * @return Whether the daemon answered with a signed token.
+	 */
+	inline bool sign(const std::string& socket_path, const std::string& request, std::string& out_token, std::string& out_error, bool& out_answered)
+	{
+		out_answered = false;
+
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		if (socket_path.empty() || socket_path.size() >= sizeof(addr.sun_path))
+		{
+			out_error = "Invalid socket path: " + socket_path;
+			return false;
+		}
+		std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+		const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd == -1)
+		{
+			out_error = std::string("socket failed: ") + std::strerror(errno);
+			return false;
+		}
+
+		timeval timeout{};
+		timeout.tv_sec = timeout_seconds;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		auto fail = [&](const char* call)
+		{
+			out_error = std::string(call) + " failed: " + std::strerror(errno);
+			close(fd);
+			return false;
+		};
+
+		if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == -1)
+		{
+			return fail("connect");
+		}
+
+		std::string frame;
+		protocol::append_frame(frame, request);
+
+		size_t sent = 0;
+		while (sent < frame.size())
+		{
+			const ssize_t n = send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+			if (n == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			if (n <= 0)
+			{
+				return fail("send");
+			}
+			sent += static_cast<size_t>(n);
+		}
+
+		std::string in, body;
+		size_t offset = 0;
+		bool too_large = false;
+		char buffer[4096];
+
+		while (!protocol::next_frame(in, offset, body, too_large))
+		{
+			if (too_large)
+			{
+				out_error = "The daemon's response exceeds the maximum frame size.";
+				close(fd);
+				return false;
+			}
+
+			const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+			if (n == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			if (n == 0)
+			{
+				out_error = "The daemon closed the connection without responding.";
+				close(fd);
+				return false;
+			}
+			if (n < 0)
+			{
+				return fail("recv");
+			}
+			in.append(buffer, static_cast<size_t>(n));
+		}
+
+		close(fd);
+		out_answered = true;
+
+		if (body.empty())
+		{
+			out_error = "The daemon sent an empty response.";
+			return false;
+		}
+
+		if (static_cast<protocol::status>(body[0]) != protocol::status::OK)
+		{
+			out_error = body.substr(1);
+			return false;
+		}
+
+		out_token = body.substr(1);
+		return true;
+	}
+#else
+	inline bool sign(const std::string&, const std::string&, std::string&, std::string& out_error, bool& out_answered)
+	{
+		out_answered = false;
+		out_error = "The signing daemon is only supported on Linux.";
+		return false;
+	}
+#endif
+}
@@ -0,0 +1,521 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <memory>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <functional>
+#include <filesystem>
+#include <unordered_map>
+#include "jwt-cpp/jwt.h"
+#include "signer.h"
+#include "protocol.h"
+
+#if __linux__
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif
+
+namespace key_store {
+	/**
+	 * Constructs the signer::algorithm to use for an already parsed key (throws if the key type doesn't fit the algorithm).
+	 */
+	using algorithm_factory = std::function<std::unique_ptr<signer::algorithm>(std::shared_ptr<EVP_PKEY>)>;
+
+	/**
+	 * A loaded signing key.
+	 */
+	struct entry
+	{
+		/// Key id: the key file's name without its extension.
+		std::string kid;
+
+		/// Path of the key file.
+		std::string path;
+
+		/// SHA-256 digest of the key file's content (tells whether a reload has to parse the file again).
+		std::string content_digest;
+
+		/// protocol::key_fingerprint() of the key.
+		std::string fingerprint;
+
+		/// The parsed key (shared by all threads).
+		std::shared_ptr<EVP_PKEY> pkey;
+
+		/// Ready-to-use algorithm instance for this key.
+		std::shared_ptr<const signer::algorithm> alg;
+	};
+
+	/**
+	 * Immutable set of loaded keys, indexed by kid.
+	 */
+	using key_set = std::unordered_map<std::string, std::shared_ptr<const entry>>;
+
+	/**
+	 * Parses a private key file's content (PEM or DER).
+	 * @param content The key file's content.
+	 * @param password Password for decrypting PEM keys (if required).
+	 * @return The parsed key; nullptr if it couldn't be parsed.
+	 */
+	inline std::shared_ptr<EVP_PKEY> parse_private_key(const std::string& content, const std::string& password)
+	{
+		if (content.find("-----BEGIN") != std::string::npos)
+		{
+			return jwt::helper::load_private_key_from_string(content, password);
+		}
+
+		const auto* p = reinterpret_cast<const unsigned char*>(content.data());
+		return std::shared_ptr<EVP_PKEY>(d2i_AutoPrivateKey(nullptr, &p, static_cast<long>(content.size())), EVP_PKEY_free);
+	}
+
+	/**
+	 * Whether the passed file extension denotes a key file (.pem, .der or .key).
+	 */
+	inline bool is_key_file_extension(const std::string& extension)
+	{
+		return extension == ".pem" || extension == ".der" || extension == ".key";
+	}
+
+	/**
+	 * Loads all key files inside a directory. Keys are parsed exactly once, here.
+	 * @param directory The directory containing the key files (the file names without extension are used as kid).
+	 * @param password Password for decrypting PEM keys (if required).
+	 * @param make_algorithm Constructs the algorithm instance for each key.
+	 * @param log Where to write warnings about keys that couldn't be loaded to.
+	 * @param previous The previously loaded keys (optional): key files whose path and content didn't change reuse their already parsed entry.
+	 * @return The loaded keys.
+	 * @throws std::filesystem::filesystem_error If the directory couldn't be read.
+	 */
+	inline std::shared_ptr<const key_set> load_directory(const std::string& directory, const std::string& password, const algorithm_factory& make_algorithm, std::ostream& log, const key_set* previous = nullptr)
+	{
+		auto keys = std::make_shared<key_set>();
+
+		for (const auto& file : std::filesystem::directory_iterator(directory))
+		{
+			if (!file.is_regular_file() || !is_key_file_extension(file.path().extension().string()))
+			{
+				continue;
+			}
+
+			auto e = std::make_shared<entry>();
+			e->kid = file.path().stem().string();
+			e->path = file.path().string();
+
+			std::ifstream fs(e->path, std::ios::binary);
+			std::stringstream content;
+			content << fs.rdbuf();
+
+			unsigned char digest[EVP_MAX_MD_SIZE];
+			unsigned int digest_len = 0;
+			if (jwt::helper::hash(EVP_sha256(), content.str(), digest, &digest_len))
+			{
+				e->content_digest.assign(reinterpret_cast<const char*>(digest), digest_len);
+			}
+
+			if (previous != nullptr)
+			{
+				const auto it = previous->find(e->kid);
+				if (it != previous->end() && it->second->path == e->path && !e->content_digest.empty() && it->second->content_digest == e->content_digest)
+				{
+					keys->emplace(e->kid, it->second);
+					continue;
+				}
+			}
+
+			e->pkey = parse_private_key(content.str(), password);
+			if (!e->pkey)
+			{
+				log << "WARNING: Skipped key file " << e->path << " (couldn't be parsed as a PEM or DER private key).\n";
+				continue;
+			}
+			e->fingerprint = protocol::key_fingerprint(e->pkey.get());
+
+			try
+			{
+				e->alg = make_algorithm(e->pkey);
+			}
+			catch (const std::exception& ex)
+			{
+				log << "WARNING: Skipped key file " << e->path << " (" << ex.what() << ").\n";
+				continue;
+			}
+
+			if (!keys->emplace(e->kid, e).second)
+			{
+				log << "WARNING: Skipped key file " << e->path << " (there is already another key with the kid \"" << e->kid << "\").\n";
+			}
+		}
+
+		return keys;
+	}
+
+	/**
+	 * Set of signing keys indexed by kid, loaded from a key directory.<p>
+	 * Tokens are signed with the key whose kid matches the token's "kid" header claim (see jwt::builder::set_key_id),
+	 * so signing by kid costs a hash lookup plus the actual crypto: no key is ever parsed after loading.<p>
+	 * The key set can be swapped at any time (see reload) while other threads are signing: every reload publishes a new immutable
+	 * key_set, and readers take a reference to the current one for the duration of a single lookup or signing operation.
+	 * In-flight signing operations keep using the key set they started with, and a replaced key set is freed as soon as the last of them is done.<p>
+	 * Lookups take no lock: std::atomic_load on a shared_ptr is implemented with a mutex (libstdc++ uses a global pool of them),
+	 * so every thread caches the current key set and only loads it again when the store's generation counter says that it was replaced.
+	 * A thread's cached key set stays alive until its next lookup after a reload; threads that go idle call release_thread_cache()
+	 * so that they don't keep a replaced key set (and its keys) in memory.
+	 */
+	class store
+	{
+	public:
+		/**
+		 * Creates an empty key store (see reload).
+		 * @param alg_name Name of the algorithm the keys are used with.
+		 * @param directory The key directory.
+		 * @param password Password for decrypting PEM keys (if required).
+		 * @param make_algorithm Constructs the algorithm instance for each key.
+		 */
+		store(std::string alg_name, std::string directory, std::string password, algorithm_factory make_algorithm)
+			: alg_name(std::move(alg_name)), directory(std::move(directory)), password(std::move(password)), make_algorithm(std::move(make_algorithm)),
+			  keys(std::make_shared<const key_set>()), generation(next_generation())
+		{
+		}
+
+		/**
+		 * (Re-)loads the key directory and atomically publishes the new key set. Unchanged key files aren't parsed again.
+		 * @param log Where to write warnings about keys that couldn't be loaded to.
+		 * @return The amount of loaded keys.
+		 * @throws std::filesystem::filesystem_error If the directory couldn't be read (the current key set stays in place).
+		 */
+		size_t reload(std::ostream& log)
+		{
+			std::lock_guard<std::mutex> lock(reload_mutex);
+			const auto current = std::atomic_load(&keys);
+			const auto next = load_directory(directory, password, make_algorithm, log, current.get());
+			publish(next);
+			return next->size();
+		}
+
+		/**
+		 * Atomically replaces the key set. Signing operations already in flight on other threads finish with the old one.
+		 * @param next The new key set.
+		 */
+		void publish(std::shared_ptr<const key_set> next)
+		{
+			// The key set has to be in place before readers see the new generation
+			std::atomic_store(&keys, std::move(next));
+			generation.store(next_generation(), std::memory_order_release);
+		}
+
+		/**
+		 * Gets the current key set.
+		 * @return The key set; it stays alive (even if it gets replaced meanwhile) as long as the caller holds the reference.
+		 */
+		std::shared_ptr<const key_set> snapshot() const
+		{
+			return current();
+		}
+
+		/**
+		 * Looks up a key by its kid.
+		 * @param kid The key id.
+		 * @return The key; nullptr if there is no key with the passed kid.
+		 */
+		std::shared_ptr<const entry> find(const std::string& kid) const
+		{
+			const key_set& set = *current();
+			const auto it = set.find(kid);
+			return it != set.end() ? it->second : nullptr;
+		}
+
+		/**
+		 * Drops the calling thread's cached key set (see the class description); call it before a thread goes idle.
+		 * The next lookup on the thread loads the current key set again.
+		 */
+		static void release_thread_cache()
+		{
+			thread_cache& cache = cached();
+			cache.generation = 0;
+			cache.keys.reset();
+		}
+
+		/**
+		 * Gets the kid of a token (its "kid" header claim).
+		 * @param token The token.
+		 * @return The kid; an empty string if the token doesn't have one.
+		 */
+		static std::string kid_of(const jwt::builder& token)
+		{
+			const auto& header = token.get_header_claims();
+			const auto it = header.find("kid");
+			return it != header.end() && it->second.get_type() == jwt::claim::type::string ? it->second.as_string() : "";
+		}
+
+		/**
+		 * Signs a token with the key selected by its "kid" header claim.
+		 * @param token The token to sign.
+		 * @return The encoded and signed jwt.
+		 * @throws std::runtime_error If the token has no kid or there is no key with that kid.
+		 */
+		std::string sign(jwt::builder& token) const
+		{
+			const std::string kid = kid_of(token);
+			if (kid.empty())
+			{
+				throw std::runtime_error("the token has no kid (pass --kid or set the kid per token) to select the signing key with");
+			}
+
+			const auto e = find(kid);
+			if (!e)
+			{
+				throw std::runtime_error("there is no signing key with the kid \"" + kid + "\"");
+			}
+
+			return e->alg->sign(token);
+		}
+
+		/**
+		 * Gets the name of the algorithm the keys are used with.
+		 */
+		const std::string& name() const
+		{
+			return alg_name;
+		}
+
+		/**
+		 * Gets the key directory.
+		 */
+		const std::string& path() const
+		{
+			return directory;
+		}
+
+		/**
+		 * Gets the amount of currently loaded keys.
+		 */
+		size_t size() const
+		{
+			return current()->size();
+		}
+
+	private:
+		/**
+		 * A thread's most recently loaded key set. Generations are unique across all stores, so one slot serves every store.
+		 */
+		struct thread_cache
+		{
+			uint64_t generation = 0;
+			std::shared_ptr<const key_set> keys;
+		};
+
+		static thread_cache& cached()
+		{
+			thread_local thread_cache cache;
+			return cache;
+		}
+
+		/**
+		 * Hands out a new generation (never 0, which marks an empty thread_cache).
+		 */
+		static uint64_t next_generation()
+		{
+			static std::atomic<uint64_t> last{ 0 };
+			return last.fetch_add(1, std::memory_order_relaxed) + 1;
+		}
+
+		/**
+		 * Gets the current key set from the calling thread's cache; only loads it (taking std::atomic_load's lock) after a reload.
+		 * @return The key set; the reference stays valid until the calling thread's next lookup or release_thread_cache() call.
+		 */
+		const std::shared_ptr<const key_set>& current() const
+		{
+			const uint64_t g = generation.load(std::memory_order_acquire);
+			thread_cache& cache = cached();
+			if (cache.generation != g)
+			{
+				cache.keys = std::atomic_load(&keys);
+				cache.generation = g;
+			}
+			return cache.keys;
+		}
+
+		const std::string alg_name;
+		const std::string directory;
+		const std::string password;
+		const algorithm_factory make_algorithm;
+
+		/// Only ever accessed via std::atomic_load/std::atomic_store.
+		std::shared_ptr<const key_set> keys;
+		/// Changes (after keys was replaced) with every publish.
+		std::atomic<uint64_t> generation;
+		std::mutex reload_mutex;
+	};
+
+	/**
+	 * signer::algorithm that signs every token with the store's key selected by the token's kid.
+	 */
+	class algorithm : public signer::algorithm
+	{
+	public:
+		explicit algorithm(std::shared_ptr<const store> keys) : keys(std::move(keys))
+		{
+		}
+
+		std::string sign(jwt::builder& token) const override
+		{
+			return keys->sign(token);
+		}
+
+		std::string name() const override
+		{
+			return keys->name();
+		}
+
+	private:
+		const std::shared_ptr<const store> keys;
+	};
+
+#if __linux__
+	/**
+	 * Watches a key store's directory with inotify and reloads the store whenever key files are written, moved or deleted.<p>
+	 * Bursts of changes (e.g. a deployment replacing several keys) are coalesced into a single reload.
+	 */
+	class watcher
+	{
+	public:
+		/**
+		 * How long the directory has to be quiet before a reload is triggered (in milliseconds).
+		 */
+		static constexpr int settle_ms = 200;
+
+		/**
+		 * Creates a watcher (see start).
+		 * @param keys The store to reload.
+		 * @param log Where to write reload reports and warnings to.
+		 */
+		watcher(std::shared_ptr<store> keys, std::ostream& log) : keys(std::move(keys)), log(log)
+		{
+		}
+
+		watcher(const watcher&) = delete;
+		watcher& operator=(const watcher&) = delete;
+
+		~watcher()
+		{
+			if (thread.joinable())
+			{
+				const uint64_t one = 1;
+				if (write(stop_fd, &one, sizeof(one)) != sizeof(one))
+				{
+					log << "WARNING: Failed to stop the key directory watcher." << std::endl;
+				}
+				thread.join();
+			}
+
+			if (inotify_fd != -1)
+			{
+				close(inotify_fd);
+			}
+
+			if (stop_fd != -1)
+			{
+				close(stop_fd);
+			}
+		}
+
+		/**
+		 * Starts watching the key directory on a background thread.
+		 * @param out_error If watching failed, the reason is written into this.
+		 * @return Whether the directory is being watched.
+		 */
+		bool start(std::string& out_error)
+		{
+			inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			stop_fd = eventfd(0, EFD_CLOEXEC);
+			if (inotify_fd == -1 || stop_fd == -1)
+			{
+				out_error = std::string("inotify/eventfd setup failed: ") + std::strerror(errno);
+				return false;
+			}
+
+			if (inotify_add_watch(inotify_fd, keys->path().c_str(), IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB) == -1)
+			{
+				out_error = std::string("inotify_add_watch failed: ") + std::strerror(errno);
+				return false;
+			}
+
+			thread = std::thread(&watcher::loop, this);
+			return true;
+		}
+
+	private:
+		/**
+		 * Reads and discards all queued inotify events.
+		 * @return Whether there were any.
+		 */
+		bool drain()
+		{
+			alignas(inotify_event) char buffer[4096];
+			bool any = false;
+			while (read(inotify_fd, buffer, sizeof(buffer)) > 0)
+			{
+				any = true;
+			}
+			return any;
+		}
+
+		void loop()
+		{
+			pollfd fds[2] = { { inotify_fd, POLLIN, 0 }, { stop_fd, POLLIN, 0 } };
+
+			for (;;)
+			{
+				if (poll(fds, 2, -1) == -1)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					log << "WARNING: Stopped watching the key directory " << keys->path() << ": " << std::strerror(errno) << std::endl;
+					return;
+				}
+
+				if (fds[1].revents != 0)
+				{
+					return;
+				}
+
+				// Wait for the directory to settle down so that a burst of changes results in one reload.
+				drain();
+				while (poll(fds, 2, settle_ms) > 0)
+				{
+					if (fds[1].revents != 0)
+					{
+						return;
+					}
+					drain();
+				}
+
+				try
+				{
+					const size_t count = keys->reload(log);
+					log << "Reloaded " << count << " key(s) from " << keys->path() << std::endl;
+				}
+				catch (const std::exception& e)
+				{
+					log << "WARNING: Failed to reload the key directory (still signing with the previous keys): " << e.what() << std::endl;
+				}
+			}
+		}
+
+		const std::shared_ptr<store> keys;
+		std::ostream& log;
+		int inotify_fd = -1;
+		int stop_fd = -1;
+		std::thread thread;
+	};
+#endif
+}
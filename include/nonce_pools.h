@@ -0,0 +1,133 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <memory>
+#include <iostream>
+#include "jwt-cpp/jwt.h"
+
+namespace nonce_pools {
+	/**
+	 * Hands out one ECDSA nonce precomputation pool per signing key (all algorithm instances created for a key share its pool)
+	 * and aggregates their metrics.
+	 */
+	class registry
+	{
+	public:
+		/**
+		 * Creates a registry.
+		 * @param capacity Amount of precomputed nonces per key.
+		 * @param threads Amount of refill threads per key.
+		 */
+		registry(size_t capacity, size_t threads) : capacity(capacity), threads(threads)
+		{
+		}
+
+		/**
+		 * Gets the pool for a key, creating it (and starting its refill threads) on first use.<p>
+		 * Pools that aren't used by any algorithm instance anymore (e.g. after a key rotation) are stopped; their metrics are kept.
+		 * @param key The EC key.
+		 * @return The key's pool.
+		 */
+		std::shared_ptr<jwt::algorithm::ecdsa_nonce_pool> get(const std::shared_ptr<EVP_PKEY>& key)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			const auto it = pools.find(key.get());
+			if (it != pools.end())
+			{
+				return it->second.pool;
+			}
+
+			retire_unused();
+
+			auto pool = std::make_shared<jwt::algorithm::ecdsa_nonce_pool>(key, capacity, threads);
+			pools.emplace(key.get(), entry{ key, pool });
+			return pool;
+		}
+
+		/**
+		 * Gets the summed up metrics of all pools (the available nonces, capacity and threads only count live pools).
+		 */
+		jwt::algorithm::ecdsa_nonce_pool::stats total()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			retire_unused();
+
+			jwt::algorithm::ecdsa_nonce_pool::stats sum = retired;
+			for (const auto& p : pools)
+			{
+				add(sum, p.second.pool->get_stats());
+			}
+			return sum;
+		}
+
+		/**
+		 * Writes the pools' metrics as one human readable line.
+		 * @param out Where to write the metrics to.
+		 */
+		void report(std::ostream& out)
+		{
+			const auto s = total();
+			out << "Nonce pool: " << s.hits << " hits, " << s.misses << " misses, refill lag " << s.avg_refill_lag_ms << " ms avg / " << s.max_refill_lag_ms << " ms max";
+			if (s.threads > 0)
+			{
+				out << ", " << s.available << '/' << s.capacity << " precomputed nonces available (" << s.threads << " refill thread(s))";
+			}
+			out << std::endl;
+		}
+
+	private:
+		/**
+		 * Adds a pool's metrics to a sum (the refill lag average is weighted by the pools' hits).
+		 */
+		static void add(jwt::algorithm::ecdsa_nonce_pool::stats& sum, const jwt::algorithm::ecdsa_nonce_pool::stats& s)
+		{
+			if (sum.hits + s.hits > 0)
+			{
+				sum.avg_refill_lag_ms = (sum.avg_refill_lag_ms * sum.hits + s.avg_refill_lag_ms * s.hits) / (sum.hits + s.hits);
+			}
+			sum.hits += s.hits;
+			sum.misses += s.misses;
+			sum.available += s.available;
+			sum.capacity += s.capacity;
+			sum.threads += s.threads;
+			sum.max_refill_lag_ms = std::max(sum.max_refill_lag_ms, s.max_refill_lag_ms);
+		}
+
+		/**
+		 * Stops the pools only the registry still references and keeps their hit/miss/lag metrics (the caller must hold the mutex).
+		 */
+		void retire_unused()
+		{
+			for (auto it = pools.begin(); it != pools.end();)
+			{
+				// Nobody else can obtain another reference to a pool only the registry holds, so this can't race.
+				if (it->second.pool.use_count() == 1)
+				{
+					auto s = it->second.pool->get_stats();
+					s.available = s.capacity = s.threads = 0;
+					add(retired, s);
+					it = pools.erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+		}
+
+		struct entry
+		{
+			/// Keeps the key (and thereby the map key's address) alive as long as its pool is registered.
+			std::shared_ptr<EVP_PKEY> key;
+			std::shared_ptr<jwt::algorithm::ecdsa_nonce_pool> pool;
+		};
+
+		const size_t capacity;
+		const size_t threads;
+		std::mutex mutex;
+		std::map<const EVP_PKEY*, entry> pools;
+		jwt::algorithm::ecdsa_nonce_pool::stats retired;
+	};
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+/*
+ * Wire protocol spoken between the jwtgen signing daemon and its clients.
+ *
+ * Every message is a frame: a 4-byte big-endian unsigned length followed by that many bytes of body.
+ *
+ * Request body:   a JSON object such as {"claims":{"sub":"JohnDoe","role":"admin"},"alg":"RS256","key":"50d858e0985ecc7f60418aaf0cc5ab587f42c2570a884095a9e8ccacd0f6545c","defaults":false}
+ *                 "claims" holds the token's payload claims.
+ *                 "alg" is optional and, if present, must match the daemon's algorithm.
+ *                 "key" is optional and, if present, must match the key_fingerprint() of the daemon's private key (so that clients never get a token signed with another key than the one they asked for).
+ *                 Clients signing with an HMAC secret don't send a fingerprint; they verify the returned token's signature with their secret instead.
+ *                 "kid" is optional and sets the token's key id header claim (which selects the signing key if the daemon signs with a key directory).
+ *                 "defaults" is optional; pass false to not apply the daemon's default claims (from its command line arguments).
+ *
+ * Response body:  one status byte (0 = OK, 1 = error) followed by the signed token (or the error message).
+ */
+namespace protocol {
+	/**
+	 * Maximum accepted frame body size (in bytes).
+	 */
+	constexpr uint32_t max_frame_size = 1024 * 1024;
+
+	/**
+	 * Size of the frame length prefix (in bytes).
+	 */
+	constexpr size_t header_size = 4;
+
+	/**
+	 * Response status codes (first byte of every response body).
+	 */
+	enum class status : uint8_t
+	{
+		OK = 0,
+		ERROR = 1,
+	};
+
+	/**
+	 * Computes the fingerprint that identifies a signing key in sign requests: the hex-encoded SHA-256 digest of the key's
+	 * public part (DER SubjectPublicKeyInfo), so it's the same for every encoding of the key and reveals nothing private.
+	 * @param key The private (or public) key.
+	 * @return The hex-encoded fingerprint; an empty string if there is no key or it couldn't be encoded.
+	 */
+	inline std::string key_fingerprint(EVP_PKEY* key)
+	{
+		if (key == nullptr)
+		{
+			return "";
+		}
+
+		unsigned char* der = nullptr;
+		const int size = i2d_PUBKEY(key, &der);
+		if (size <= 0)
+		{
+			return "";
+		}
+
+		unsigned char digest[EVP_MAX_MD_SIZE];
+		unsigned int digest_len = 0;
+		const bool ok = EVP_Digest(der, static_cast<size_t>(size), digest, &digest_len, EVP_sha256(), nullptr) == 1;
+		OPENSSL_free(der);
+		if (!ok)
+		{
+			return "";
+		}
+
+		static const char hex[] = "0123456789abcdef";
+		std::string out(digest_len * 2, '0');
+		for (unsigned int i = 0; i < digest_len; ++i)
+		{
+			out[i * 2] = hex[digest[i] >> 4];
+			out[i * 2 + 1] = hex[digest[i] & 0xF];
+		}
+		return out;
+	}
+
+	/**
+	 * Appends the 4-byte big-endian frame length prefix to a buffer.
+	 * @param out The buffer to append to.
+	 * @param size The frame body size.
+	 */
+	inline void append_header(std::string& out, uint32_t size)
+	{
+		out += static_cast<char>((size >> 24) & 0xFF);
+		out += static_cast<char>((size >> 16) & 0xFF);
+		out += static_cast<char>((size >> 8) & 0xFF);
+		out += static_cast<char>(size & 0xFF);
+	}
+
+	/**
+	 * Appends a complete frame to a buffer.
+	 * @param out The buffer to append to.
+	 * @param body The frame body.
+	 */
+	inline void append_frame(std::string& out, const std::string& body)
+	{
+		append_header(out, static_cast<uint32_t>(body.size()));
+		out += body;
+	}
+
+	/**
+	 * Appends a complete response frame (status byte + body) to a buffer.
+	 * @param out The buffer to append to.
+	 * @param s The response status.
+	 * @param body The signed token or error message.
+	 */
+	inline void append_response(std::string& out, status s, const std::string& body)
+	{
+		append_header(out, static_cast<uint32_t>(body.size() + 1));
+		out += static_cast<char>(s);
+		out += body;
+	}
+
+	/**
+	 * Reads the frame length prefix at the given offset.
+	 * @param buffer The receive buffer.
+	 * @param offset Offset of the frame's first byte.
+	 * @return The frame body size.
+	 */
+	inline uint32_t read_header(const std::string& buffer, size_t offset)
+	{
+		const auto* p = reinterpret_cast<const unsigned char*>(buffer.data() + offset);
+		return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+	}
+
+	/**
+	 * Tries to extract the next complete frame from a receive buffer.
+	 * @param buffer The receive buffer.
+	 * @param offset Offset of the next unread frame; advanced past the frame if one was extracted.
+	 * @param out_body Where to write the frame body to.
+	 * @param out_too_large Set to true if the frame announces a body larger than max_frame_size (the connection should be dropped in that case).
+	 * @return Whether a complete frame was extracted.
+	 */
+	inline bool next_frame(const std::string& buffer, size_t& offset, std::string& out_body, bool& out_too_large)
+	{
+		out_too_large = false;
+
+		if (buffer.size() - offset < header_size)
+		{
+			return false;
+		}
+
+		const uint32_t size = read_header(buffer, offset);
+		if (size > max_frame_size)
+		{
+			out_too_large = true;
+			return false;
+		}
+
+		if (buffer.size() - offset - header_size < size)
+		{
+			return false;
+		}
+
+		out_body.assign(buffer, offset + header_size, size);
+		offset += header_size + size;
+		return true;
+	}
+}
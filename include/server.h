@@ -0,0 +1,666 @@
+#pragma once
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <iostream>
+#include <unordered_set>
+#include "jwt-cpp/jwt.h"
+#include "signer.h"
+#include "protocol.h"
+
+#if __linux__
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace server {
+	/**
+	 * Compares two ASCII strings case-insensitively (algorithm names are matched the same way as the --alg argument).
+	 */
+	inline bool equals_ignore_case(const std::string& a, const std::string& b)
+	{
+		if (a.size() != b.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			if (toupper(static_cast<unsigned char>(a[i])) != toupper(static_cast<unsigned char>(b[i])))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * The key a request gets signed with.
+	 */
+	struct signing_key
+	{
+		/// protocol::key_fingerprint() of the key; nullptr if unknown.
+		std::shared_ptr<const std::string> fingerprint;
+
+		/// Signs with the key; nullptr to sign with the daemon's algorithm.
+		std::shared_ptr<const signer::algorithm> alg;
+	};
+
+	/**
+	 * Signing daemon configuration.
+	 */
+	struct config
+	{
+		/// The token holding the default claims (from the daemon's command line arguments).
+		jwt::builder prototype = jwt::create();
+
+		/// Whether to set the "iat" claim to the current time if the request doesn't contain one.
+		bool stamp_iat = true;
+
+		/// Selects the key a token gets signed with; called once per request, so the fingerprint check and the signature use the same key
+		/// even if the keys are reloaded meanwhile. If empty, tokens are signed with the daemon's algorithm and requests can't pass a fingerprint.
+		std::function<signing_key(const jwt::builder&)> resolve_key;
+
+		/// Called by an event loop thread after it has been idle for idle_ms (e.g. to release per-thread caches).
+		std::function<void()> on_idle;
+
+		/// How long an event loop thread has to wait for events before on_idle is called (in milliseconds).
+		int idle_ms = 1000;
+	};
+
+	/**
+	 * Turns a sign request (see protocol.h) into a signed token.
+	 * @param cfg The daemon configuration.
+	 * @param alg The algorithm to sign with.
+	 * @param request The request frame body.
+	 * @param out_status Set to protocol::status::OK on success and protocol::status::ERROR otherwise.
+	 * @return The signed token; the error message if the request couldn't be handled.
+	 */
+	inline std::string handle_request(const config& cfg, const signer::algorithm& alg, const std::string& request, protocol::status& out_status)
+	{
+		out_status = protocol::status::ERROR;
+
+		picojson::value json;
+		const std::string error = picojson::parse(json, request);
+		if (!error.empty())
+		{
+			return "Invalid request JSON: " + error;
+		}
+
+		if (!json.is<picojson::object>())
+		{
+			return "The request is not a JSON object.";
+		}
+
+		const picojson::object& obj = json.get<picojson::object>();
+
+		const auto alg_it = obj.find("alg");
+		if (alg_it != obj.end())
+		{
+			if (!alg_it->second.is<std::string>() || !equals_ignore_case(alg_it->second.get<std::string>(), alg.name()))
+			{
+				return "Algorithm mismatch: this daemon signs with " + alg.name();
+			}
+		}
+
+		const auto defaults_it = obj.find("defaults");
+		const bool apply_defaults = defaults_it == obj.end() || !defaults_it->second.is<bool>() || defaults_it->second.get<bool>();
+
+		jwt::builder token = apply_defaults ? cfg.prototype : jwt::create();
+
+		if (cfg.stamp_iat)
+		{
+			token.set_issued_at(std::chrono::system_clock::now());
+		}
+
+		const auto kid_it = obj.find("kid");
+		if (kid_it != obj.end())
+		{
+			if (!kid_it->second.is<std::string>())
+			{
+				return "The request's \"kid\" field is not a string.";
+			}
+			token.set_key_id(kid_it->second.get<std::string>());
+		}
+
+		const auto claims_it = obj.find("claims");
+		if (claims_it != obj.end())
+		{
+			if (!claims_it->second.is<picojson::object>())
+			{
+				return "The request's \"claims\" field is not a JSON object.";
+			}
+
+			for (const auto& claim : claims_it->second.get<picojson::object>())
+			{
+				token.set_payload_claim(claim.first, jwt::claim(claim.second));
+			}
+		}
+
+		const signing_key key = cfg.resolve_key ? cfg.resolve_key(token) : signing_key();
+
+		const auto key_it = obj.find("key");
+		if (key_it != obj.end())
+		{
+			if (!key_it->second.is<std::string>() || !key.fingerprint || key_it->second.get<std::string>() != *key.fingerprint)
+			{
+				return "Key mismatch: this daemon signs with another key.";
+			}
+		}
+
+		try
+		{
+			std::string jwt = key.alg ? key.alg->sign(token) : alg.sign(token);
+			out_status = protocol::status::OK;
+			return jwt;
+		}
+		catch (const std::exception& e)
+		{
+			return std::string("Failed to sign the token: ") + e.what();
+		}
+	}
+
+#if __linux__
+	/**
+	 * Per-client connection state. Thanks to EPOLLONESHOT only one event loop thread handles a connection at any given time.
+	 */
+	struct connection
+	{
+		int fd = -1;
+
+		/// Received bytes that haven't been consumed as a complete frame yet.
+		std::string in;
+
+		/// Response bytes that haven't been sent yet.
+		std::string out;
+		size_t out_offset = 0;
+
+		/// Whether the peer closed its writing end (or an error occurred).
+		bool closing = false;
+	};
+
+	/**
+	 * Written to by the SIGINT/SIGTERM handler to wake up and stop all event loop threads.
+	 */
+	static int shutdown_fd = -1;
+
+	inline void on_shutdown_signal(int)
+	{
+		const uint64_t one = 1;
+		const ssize_t ignored = write(shutdown_fd, &one, sizeof(one));
+		(void)ignored;
+	}
+
+	/**
+	 * Signing daemon listening on a Unix domain socket.<p>
+	 * The key is loaded and the algorithm constructed exactly once per process; all event loop threads share the same epoll instance.
+	 */
+	class signing_daemon
+	{
+	public:
+		/**
+		 * Stop reading a connection's requests while this many response bytes are waiting for the client to read them.
+		 */
+		static constexpr size_t max_pending_output = 1024 * 1024;
+
+		/**
+		 * Maximum amount of bytes read from one connection per wakeup, so that a client that keeps writing can't occupy an event loop thread.
+		 */
+		static constexpr size_t max_read_per_event = 256 * 1024;
+
+		signing_daemon(config cfg, std::unique_ptr<signer::algorithm> alg)
+			: cfg(std::move(cfg)), alg(std::move(alg))
+		{
+		}
+
+		~signing_daemon()
+		{
+			for (connection* c : connections)
+			{
+				close(c->fd);
+				delete c;
+			}
+			if (listener.fd != -1)
+			{
+				close(listener.fd);
+				unlink(socket_path.c_str());
+			}
+			if (shutdown.fd != -1)
+			{
+				close(shutdown.fd);
+				shutdown_fd = -1;
+			}
+			if (epoll_fd != -1)
+			{
+				close(epoll_fd);
+			}
+		}
+
+		/**
+		 * Binds the Unix domain socket and sets up the epoll instance.
+		 * @param path The socket file path.
+		 * @return An error message; empty if everything went fine.
+		 */
+		std::string listen(const std::string& path)
+		{
+			sockaddr_un addr{};
+			addr.sun_family = AF_UNIX;
+			if (path.empty() || path.size() >= sizeof(addr.sun_path))
+			{
+				return "Invalid socket path (it must be non-empty and shorter than " + std::to_string(sizeof(addr.sun_path)) + " characters): " + path;
+			}
+			std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+			// Remove stale socket files left behind by a daemon that didn't shut down cleanly, but never steal a live daemon's socket.
+			struct stat st{};
+			if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+			{
+				const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+				const bool alive = probe != -1 && connect(probe, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0;
+				if (probe != -1)
+				{
+					close(probe);
+				}
+				if (alive)
+				{
+					return "Another daemon is already listening on " + path;
+				}
+				unlink(path.c_str());
+			}
+
+			listener.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			if (listener.fd == -1)
+			{
+				return errno_message("socket");
+			}
+			if (bind(listener.fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == -1)
+			{
+				const std::string error = errno_message("bind");
+				close(listener.fd);
+				listener.fd = -1;
+				return error;
+			}
+			socket_path = path;
+			if (::listen(listener.fd, SOMAXCONN) == -1)
+			{
+				return errno_message("listen");
+			}
+
+			epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+			if (epoll_fd == -1)
+			{
+				return errno_message("epoll_create1");
+			}
+
+			shutdown.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (shutdown.fd == -1)
+			{
+				return errno_message("eventfd");
+			}
+			shutdown_fd = shutdown.fd;
+
+			// Level-triggered and never consumed: once signalled, every event loop thread wakes up and exits.
+			if (!add(&shutdown, EPOLLIN) || !add(&listener, EPOLLIN | EPOLLONESHOT))
+			{
+				return errno_message("epoll_ctl");
+			}
+
+			return "";
+		}
+
+		/**
+		 * Runs the event loop on the passed amount of threads until SIGINT or SIGTERM is received.
+		 * @param thread_count Amount of event loop threads.
+		 */
+		void run(size_t thread_count)
+		{
+			std::signal(SIGINT, on_shutdown_signal);
+			std::signal(SIGTERM, on_shutdown_signal);
+			std::signal(SIGPIPE, SIG_IGN);
+
+			std::vector<std::thread> threads;
+			for (size_t i = 1; i < thread_count; ++i)
+			{
+				threads.emplace_back(&signing_daemon::loop, this);
+			}
+			loop();
+
+			for (auto& t : threads)
+			{
+				t.join();
+			}
+		}
+
+		/**
+		 * Gets the total amount of handled sign requests.
+		 */
+		size_t request_count() const
+		{
+			return requests.load();
+		}
+
+	private:
+		static std::string errno_message(const char* call)
+		{
+			return std::string(call) + " failed: " + std::strerror(errno);
+		}
+
+		bool add(connection* c, uint32_t events)
+		{
+			epoll_event ev{};
+			ev.events = events;
+			ev.data.ptr = c;
+			return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) == 0;
+		}
+
+		bool rearm(connection* c, uint32_t events)
+		{
+			epoll_event ev{};
+			ev.events = events | EPOLLONESHOT;
+			ev.data.ptr = c;
+			return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == 0;
+		}
+
+		void drop(connection* c)
+		{
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, nullptr);
+			close(c->fd);
+			{
+				std::lock_guard<std::mutex> lock(connections_mutex);
+				connections.erase(c);
+			}
+			delete c;
+		}
+
+		void loop()
+		{
+			constexpr int max_events = 64;
+			epoll_event events[max_events];
+			bool idle = !cfg.on_idle;
+
+			for (;;)
+			{
+				const int n = epoll_wait(epoll_fd, events, max_events, idle ? -1 : cfg.idle_ms);
+				if (n == -1)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					std::cerr << "ERROR: " << errno_message("epoll_wait") << std::endl;
+					return;
+				}
+				if (n == 0)
+				{
+					cfg.on_idle();
+					idle = true;
+					continue;
+				}
+				idle = !cfg.on_idle;
+
+				for (int i = 0; i < n; ++i)
+				{
+					auto* c = static_cast<connection*>(events[i].data.ptr);
+					if (c == &shutdown)
+					{
+						return;
+					}
+					if (c == &listener)
+					{
+						accept_all();
+						continue;
+					}
+					handle(c, events[i].events);
+				}
+			}
+		}
+
+		void accept_all()
+		{
+			for (;;)
+			{
+				const int fd = accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (fd == -1)
+				{
+					if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+					{
+						std::cerr << "WARNING: " << errno_message("accept4") << std::endl;
+					}
+					if (errno != EINTR && errno != ECONNABORTED)
+					{
+						break;
+					}
+					continue;
+				}
+
+				auto* c = new connection();
+				c->fd = fd;
+				{
+					std::lock_guard<std::mutex> lock(connections_mutex);
+					connections.insert(c);
+				}
+
+				if (!add(c, EPOLLIN | EPOLLRDHUP | EPOLLONESHOT))
+				{
+					drop(c);
+				}
+			}
+
+			rearm(&listener, EPOLLIN);
+		}
+
+		void handle(connection* c, uint32_t events)
+		{
+			if (!serve(c, (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0))
+			{
+				drop(c);
+				return;
+			}
+
+			const size_t pending_output = c->out.size() - c->out_offset;
+			if (c->closing && pending_output == 0)
+			{
+				drop(c);
+				return;
+			}
+
+			// Don't read more requests while the client isn't reading the responses.
+			uint32_t interest = pending_output > 0 ? static_cast<uint32_t>(EPOLLOUT) : 0u;
+			if (!c->closing && pending_output < max_pending_output)
+			{
+				interest |= static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP);
+			}
+
+			if (!rearm(c, interest))
+			{
+				drop(c);
+			}
+		}
+
+		/**
+		 * Answers the buffered requests, sends the responses and reads further requests, until the socket has no more data,
+		 * the client has to read the pending responses first or the read budget of this wakeup is used up.
+		 * @param c The connection.
+		 * @param readable Whether the socket reported data (or a hang-up) to read.
+		 * @return false if the connection broke.
+		 */
+		bool serve(connection* c, bool readable)
+		{
+			char buffer[64 * 1024];
+			size_t budget = max_read_per_event;
+
+			for (;;)
+			{
+				const bool held_back = process_frames(c);
+				if (!send_pending(c))
+				{
+					return false;
+				}
+				const size_t pending_output = c->out.size() - c->out_offset;
+				if (pending_output >= max_pending_output)
+				{
+					return true;
+				}
+				if (held_back)
+				{
+					continue;
+				}
+				if (!readable || c->closing || budget == 0)
+				{
+					return true;
+				}
+
+				// Never buffer more than one maximum-sized frame (process_frames consumes every complete one).
+				const size_t room = protocol::header_size + protocol::max_frame_size - c->in.size();
+				const size_t n_max = std::min({ sizeof(buffer), budget, room });
+				if (n_max == 0)
+				{
+					return true;
+				}
+
+				const ssize_t n = recv(c->fd, buffer, n_max, 0);
+				if (n > 0)
+				{
+					c->in.append(buffer, static_cast<size_t>(n));
+					budget -= static_cast<size_t>(n);
+					continue;
+				}
+				if (n == -1 && errno == EINTR)
+				{
+					continue;
+				}
+				if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				{
+					c->closing = true;
+				}
+				readable = false;
+			}
+		}
+
+		/**
+		 * Answers the complete requests in the receive buffer, unless too many response bytes are already pending.
+		 * @param c The connection.
+		 * @return Whether requests were held back because of pending responses.
+		 */
+		bool process_frames(connection* c)
+		{
+			size_t offset = 0;
+			bool too_large = false;
+			bool held_back = false;
+			std::string request;
+			for (;;)
+			{
+				if (c->out.size() - c->out_offset >= max_pending_output)
+				{
+					held_back = true;
+					break;
+				}
+				if (!protocol::next_frame(c->in, offset, request, too_large))
+				{
+					break;
+				}
+				protocol::status status;
+				const std::string response = handle_request(cfg, *alg, request, status);
+				protocol::append_response(c->out, status, response);
+				requests.fetch_add(1, std::memory_order_relaxed);
+			}
+			c->in.erase(0, offset);
+
+			if (too_large)
+			{
+				protocol::append_response(c->out, protocol::status::ERROR, "Request frame exceeds the maximum size of " + std::to_string(protocol::max_frame_size) + " bytes.");
+				c->in.clear();
+				c->closing = true;
+			}
+			return held_back && !too_large;
+		}
+
+		/**
+		 * Sends as much of the pending output as the socket accepts.
+		 * @return false if the connection broke.
+		 */
+		bool send_pending(connection* c)
+		{
+			while (c->out_offset < c->out.size())
+			{
+				const ssize_t n = send(c->fd, c->out.data() + c->out_offset, c->out.size() - c->out_offset, MSG_NOSIGNAL);
+				if (n > 0)
+				{
+					c->out_offset += static_cast<size_t>(n);
+					continue;
+				}
+				if (n == -1 && errno == EINTR)
+				{
+					continue;
+				}
+				return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+			}
+			c->out.clear();
+			c->out_offset = 0;
+			return true;
+		}
+
+		const config cfg;
+		const std::unique_ptr<signer::algorithm> alg;
+
+		std::string socket_path;
+		int epoll_fd = -1;
+		connection listener;
+		connection shutdown;
+
+		std::mutex connections_mutex;
+		std::unordered_set<connection*> connections;
+
+		std::atomic<size_t> requests{ 0 };
+	};
+#endif
+
+	/**
+	 * Runs the signing daemon until SIGINT or SIGTERM is received.
+	 * @param cfg The daemon configuration.
+	 * @param factory The factory used for creating the signing algorithm (only one instance is created and shared by all threads).
+	 * @param socket_path The Unix domain socket path to listen on.
+	 * @param thread_count Amount of event loop threads.
+	 * @return 0 if the daemon shut down cleanly; 2 if it couldn't be started.
+	 */
+	inline int run(config cfg, const signer::factory& factory, const std::string& socket_path, size_t thread_count)
+	{
+#if __linux__
+		std::unique_ptr<signer::algorithm> alg = factory();
+
+		// Encode the default header once; requests only re-encode it if they set another kid.
+		cfg.prototype.prepare_header(alg->name());
+
+		signing_daemon d(std::move(cfg), std::move(alg));
+
+		const std::string error = d.listen(socket_path);
+		if (!error.empty())
+		{
+			std::cerr << "ERROR: Failed to start the signing daemon: " << error << std::endl;
+			return 2;
+		}
+
+		thread_count = std::max<size_t>(thread_count, 1);
+		std::cerr << "Signing daemon listening on " << socket_path << " (" << thread_count << " thread(s))" << std::endl;
+
+		d.run(thread_count);
+
+		std::cerr << "Signing daemon shut down after handling " << d.request_count() << " requests." << std::endl;
+		return 0;
+#else
+		std::cerr << "ERROR: The signing daemon is only supported on Linux." << std::endl;
+		return 2;
+#endif
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <functional>
+#include "jwt-cpp/jwt.h"
+
+namespace signer {
+	/**
+	 * Type-erased jwt signing algorithm, so that the jwt::algorithm to use can be selected at runtime (e.g. via --alg).
+	 */
+	class algorithm
+	{
+	public:
+		virtual ~algorithm() = default;
+
+		/**
+		 * Signs the passed token and returns it in its encoded form.
+		 * @param token The token to sign.
+		 * @return The encoded and signed jwt.
+		 */
+		virtual std::string sign(jwt::builder& token) const = 0;
+
+		/**
+		 * Gets the name of the wrapped algorithm (e.g. "RS256").
+		 * @return The algorithm name.
+		 */
+		virtual std::string name() const = 0;
+	};
+
+	/**
+	 * signer::algorithm implementation wrapping a concrete jwt::algorithm instance.
+	 * @tparam T The jwt::algorithm type (e.g. jwt::algorithm::rs256).
+	 */
+	template<typename T>
+	class algorithm_impl : public algorithm
+	{
+	public:
+		explicit algorithm_impl(T alg) : alg(std::move(alg))
+		{
+		}
+
+		std::string sign(jwt::builder& token) const override
+		{
+			return token.sign(alg);
+		}
+
+		std::string name() const override
+		{
+			return alg.name();
+		}
+
+	private:
+		const T alg;
+	};
+
+	/**
+	 * Wraps a jwt::algorithm instance into a signer::algorithm.
+	 * @param alg The jwt::algorithm to wrap.
+	 * @return The type-erased algorithm.
+	 */
+	template<typename T>
+	inline std::unique_ptr<algorithm> wrap(T alg)
+	{
+		return std::unique_ptr<algorithm>(new algorithm_impl<T>(std::move(alg)));
+	}
+
+	/**
+	 * Wraps a jwt::algorithm instance into a signer::algorithm that remembers its signatures in a memo.<p>
+	 * Randomized algorithms (ECDSA, RSASSA-PSS) can't be memoized and are wrapped as they are.
+	 * @param alg The jwt::algorithm to wrap.
+	 * @param memo The memo to share (nullptr disables memoization).
+	 * @param key_id Identifies the signing key within the memo.
+	 * @return The type-erased algorithm.
+	 */
+	template<typename T>
+	inline std::unique_ptr<algorithm> wrap(T alg, const std::shared_ptr<jwt::algorithm::signature_memo>& memo, const std::string& key_id)
+	{
+		if constexpr (jwt::algorithm::is_deterministic<T>::value)
+		{
+			if (memo)
+			{
+				return wrap(jwt::algorithm::memoized<T>(std::move(alg), memo, key_id));
+			}
+		}
+		return wrap(std::move(alg));
+	}
+
+	/**
+	 * Creates a new, independent signer::algorithm instance every time it's invoked.
+	 */
+	using factory = std::function<std::unique_ptr<algorithm>()>;
+}
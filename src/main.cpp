@@ -17,6 +17,7 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <thread>
 #if _WIN32
 #include <openssl/applink.c>
 #endif
@@ -24,6 +25,12 @@
 #include "jwt-cpp/jwt.h"
 #include "optionparser.h"
 #include "clipboard.h"
+#include "signer.h"
+#include "batch.h"
+#include "server.h"
+#include "client.h"
+#include "key_store.h"
+#include "nonce_pools.h"
 
 enum optionIndex
 {
@@ -40,12 +47,22 @@ enum optionIndex
 	IAT,
 	NBF,
 	CLAIM,
+	BATCH,
+	THREADS,
+	SOCKET,
+	CONNECT,
+	KEYS,
+	KID,
+	NONCE_POOL,
+	NONCE_POOL_THREADS,
+	SIGN_MEMO,
 };
 
 using option::Arg;
 
 const option::Descriptor usage[] = {
-	{UNKNOWN, 0, "",      "",      Arg::None,     "\nUsage:  \tjwtgen [options]\n\n" "Options:"},
+	{UNKNOWN, 0, "",      "",      Arg::None,     "\nUsage:  \tjwtgen [options]\n"
+												  "        \tjwtgen serve --socket=PATH [options]\n\n" "Options:"},
 	{HELP,    0, "h",     "help",  Arg::Optional, "  -h, --help  \tPrint usage and exit."},
 	{COPY,    0, "c",     "copy",  Arg::Optional, "  -c, --copy  \tCopy generated token to clipboard automatically."},
 	{ISS,     0, "i",     "iss",   Arg::Optional, "  -i, --iss  \tThe jwt's issuer (name of who created/signed this token)."},
@@ -55,14 +72,25 @@ const option::Descriptor usage[] = {
 	{IAT,     0, "",      "iat",   Arg::Optional, "  --iat  \tThe numeric date format of when this token was issued. If you don't pass this argument, it defaults to the current time in UTC."},
 	{NBF,     0, "",      "nbf",   Arg::Optional, "  --nbf  \tDatetime of when the jwt starts being valid (in numeric date format, just as in the --exp argument)."},
 	{CLAIM,   0, "",      "claim", Arg::Optional, "  --claim \tPut as many claims in as you need. Specify them with the syntax \"--claim=CLAIM_NAME:CLAIM_VALUE\" (without quotation marks)."},
-	{ALG,     0, "",      "alg",   Arg::Optional, "  --alg \tThe algorithm to use for signing the token. Can be HS256, HS384, HS512, RS256, RS384 or RS512."},
-	{KEY,     0, "k",     "key",   Arg::Optional, "  -k, --key \tThe secret string to use for signing the token (when selected an HMACSHA algo) __OR__ the file path to the private RSA key used for signing the token (for RSASHA algorithms) - the file must be a text file containing the private key in PEM format. If omitted, the token won't be signed at all (the --alg argument is ignored in that case)."},
-	{PW,      0, "p",     "pw",    Arg::Optional, "  -p, --pw  \tPassword for decrypting the RSA key (if the key requires one)."},
+	{ALG,     0, "",      "alg",   Arg::Optional, "  --alg \tThe algorithm to use for signing the token. Can be HS256, HS384, HS512, RS256, RS384, RS512, PS256, PS384, PS512, ES256 (P-256 key), ES384 (P-384 key), ES512 (P-521 key) or EdDSA (Ed25519 or Ed448 key)."},
+	{KEY,     0, "k",     "key",   Arg::Optional, "  -k, --key \tThe secret string to use for signing the token (when selected an HMACSHA algo) __OR__ the file path to the private key used for signing the token (for the RSASHA, RSASSA-PSS, ECDSA and EdDSA algorithms) - the file must contain the private key in PEM (or DER) format. If omitted, the token won't be signed at all (the --alg argument is ignored in that case)."},
+	{PW,      0, "p",     "pw",    Arg::Optional, "  -p, --pw  \tPassword for decrypting the private key (if the key requires one)."},
+	{KEYS,    0, "",      "keys",  Arg::Optional, "  --keys  \tDirectory of private key files (PEM or DER; *.pem, *.der or *.key) to sign with instead of a single --key. All keys are parsed once at startup and indexed by their file name without extension, which is the kid to select them with (see --kid). Requires --alg to be set to an asymmetric algorithm."},
+	{NONCE_POOL, 0, "",   "nonce-pool", Arg::Optional, "  --nonce-pool  \tES256/ES384/ES512 in batch and serve mode: amount of ECDSA signing nonces to precompute per key in the background (default 0 = disabled). Signatures that find a precomputed nonce skip the expensive scalar multiplication. The pool's hits, misses and refill lag are reported on exit."},
+	{NONCE_POOL_THREADS, 0, "", "nonce-pool-threads", Arg::Optional, "  --nonce-pool-threads  \tAmount of background threads refilling each key's nonce pool (default 1)."},
+	{SIGN_MEMO, 0, "",    "sign-memo", Arg::Optional, "  --sign-memo  \tRS256/RS384/RS512 and EdDSA in batch and serve mode: amount of signatures to remember (default 0 = disabled). A token whose header and payload were already signed with the same key gets the remembered signature instead of running the private key operation again. Not available for ES* and PS*, whose signatures are randomized, nor for HS* (an HMAC costs about as much as the memo lookup). The memo's hits and misses are reported on exit."},
+	{KID,     0, "",      "kid",   Arg::Optional, "  --kid  \tThe jwt's key id header claim. When signing with a key directory (--keys), this selects the signing key."},
+	{BATCH,   0, "",      "batch", Arg::Optional, "  --batch  \tBatch mode: read newline-delimited JSON claim objects from stdin (or from the file passed via --batch=FILE) and print one signed token per line. The other claim arguments act as defaults for every token. The signing key is only loaded once for the whole batch, and the throughput is reported in tokens/sec at the end."},
+	{THREADS, 0, "",      "threads", Arg::Optional, "  --threads  \tAmount of worker threads to sign with in batch mode (each thread uses its own algorithm instance). Defaults to the amount of hardware threads. The tokens are always printed in input order. In serve mode, this is the amount of event loop threads."},
+	{SOCKET,  0, "",      "socket", Arg::Optional, "  --socket  \tServe mode (jwtgen serve): Unix domain socket path to listen on for sign requests. The key is loaded only once and the other claim arguments act as defaults for every request. If --iat isn't passed, each token's iat is set to the time of its request."},
+	{CONNECT, 0, "",      "connect", Arg::Optional, "  --connect  \tSocket path of a running signing daemon (jwtgen serve) to forward the token generation to (defaults to the JWTGEN_SOCKET environment variable). Falls back to signing in-process if the daemon doesn't answer or uses another algorithm or key."},
 	{UNKNOWN, 0, "",      "",      Arg::None,     "\nExamples:"
 												  "\n  jwtgen -iglitchedtime -c --exp=1587399600"
 												  "\n  jwtgen --iss=glitchedpolygons --copy -kSecretSigningKey"
 												  "\n  jwtgen --iss=glitchedpolygons --copy --key=SecretSigningKey --alg=hs512"
-												  "\n  jwtgen --iss=otherIssuerName --nbf=1587399600 --claim=role:admin --claim=projectId:7 --alg=rs256 --key=/home/username/private-key.pem --pw=KeyDecryptionPassphrase123\n\n"
+												  "\n  jwtgen --iss=otherIssuerName --nbf=1587399600 --claim=role:admin --claim=projectId:7 --alg=rs256 --key=/home/username/private-key.pem --pw=KeyDecryptionPassphrase123"
+												  "\n  jwtgen --iss=glitchedpolygons --alg=rs256 --key=/home/username/private-key.pem --batch=claims.ndjson > tokens.txt"
+												  "\n  jwtgen serve --socket=/run/jwtgen.sock --iss=glitchedpolygons --alg=rs256 --key=/home/username/private-key.pem\n\n"
 												  "Fully qualified arguments (double-dash) need to have the equals sign '=' between them and their values."},
 
 	{0,       0, nullptr, nullptr, nullptr,       nullptr}
@@ -113,7 +141,7 @@ inline const static std::chrono::system_clock::time_point string_to_time_point(c
  */
 inline const static string read_file_as_text(const string& path)
 {
-	std::ifstream fs(path);
+	std::ifstream fs(path, std::ios::binary);
 	if (!fs.good())
 	{
 		return "";
@@ -124,55 +152,460 @@ inline const static string read_file_as_text(const string& path)
 }
 
 /**
- * Given a private key in PEM string format, this function returns its public key (also as a PEM-formatted string).
- * @param pem Private key PEM string
- * @return The PEM-formatted public key string; an empty string if conversion failed in some way.
+ * Finalizes the jwt generation procedure by printing out the
+ * generated token to the console and eventually copying it to the clipboard.
+ * @param jwt The generated jwt.
+ * @param copy Should the generated jwt also be copied to the clipboard?
  */
-inline const static string extract_pub_key_from_private_pem(const string& pem)
+const void finalize(const string& jwt, const bool& copy)
 {
-	if (pem.empty())
+	cout << endl << jwt << endl;
+	if (copy)
 	{
-		return "";
+		clipboard::copy_txt(jwt);
 	}
+}
 
-	BIO* bio = BIO_new(BIO_s_mem());
-	BIO_write(bio, pem.c_str(), pem.size());
+/**
+ * Gets the (upper-cased) name of the signing algorithm selected via the --alg and --key (or --keys) arguments.
+ * @param options The parsed jwtgen command line arguments.
+ * @return The algorithm name: "none" if no key was passed and HS256 if no algorithm was passed.
+ */
+static string selected_algorithm_name(const option::Option* options)
+{
+	const option::Option* key = options[KEY];
+	const option::Option* keys = options[KEYS];
+	if ((key == nullptr || key->arg == nullptr) && (keys == nullptr || keys->last()->arg == nullptr))
+	{
+		return "none";
+	}
+
+	const option::Option* alg = options[ALG];
+	if (alg == nullptr)
+	{
+		return "HS256";
+	}
 
-	EVP_PKEY* pkey = nullptr;
-	PEM_read_bio_PrivateKey(bio, &pkey, nullptr, nullptr);
+	string alg_name(alg->arg);
+	for (char& c : alg_name)
+	{
+		c = toupper(c);
+	}
+	return alg_name;
+}
 
-	if (pkey == nullptr)
+/**
+ * Gets the protocol::key_fingerprint() of the private key file selected via the --key and --pw arguments.
+ * @param options The parsed jwtgen command line arguments.
+ * @param alg_name The selected algorithm name (see selected_algorithm_name).
+ * @return The fingerprint; an empty string for HMAC secrets, if there is no key or if it couldn't be loaded.
+ */
+static string key_file_fingerprint(const option::Option* options, const string& alg_name)
+{
+	const option::Option* key = options[KEY];
+	if (key == nullptr || key->arg == nullptr || alg_name.compare(0, 2, "HS") == 0)
 	{
 		return "";
 	}
 
-	char* tmp_path = std::tmpnam(nullptr);
-	FILE* tmp_file = fopen(tmp_path, "wb");
+	const option::Option* pw = options[PW];
+	const auto pkey = key_store::parse_private_key(read_file_as_text(key->arg), pw != nullptr && pw->arg != nullptr ? pw->arg : "");
+	return protocol::key_fingerprint(pkey.get());
+}
+
+/**
+ * Checks whether a token was signed with the passed HMAC secret.
+ * @param jwt The encoded token.
+ * @param alg_name The HMAC algorithm name (HS256, HS384 or HS512).
+ * @param secret The HMAC secret.
+ * @return Whether the token's signature is valid.
+ */
+static bool signed_with_secret(const string& jwt, const string& alg_name, const string& secret)
+{
+	const size_t dot = jwt.rfind('.');
+	if (dot == string::npos)
+	{
+		return false;
+	}
+
+	try
+	{
+		const string signature = jwt::base::decode_unpadded<jwt::alphabet::base64url>(jwt.substr(dot + 1));
+		const std::string_view data(jwt.data(), dot);
+		if (alg_name == "HS384")
+		{
+			jwt::algorithm::hs384{ secret }.verify(data, signature);
+		}
+		else if (alg_name == "HS512")
+		{
+			jwt::algorithm::hs512{ secret }.verify(data, signature);
+		}
+		else
+		{
+			jwt::algorithm::hs256{ secret }.verify(data, signature);
+		}
+		return true;
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+}
+
+/**
+ * Forwards the token generation to a running signing daemon instead of loading the key and signing in-process.
+ * @param socket_path The daemon's socket path.
+ * @param options The parsed jwtgen command line arguments.
+ * @param token The token to sign (all of its payload claims are sent to the daemon).
+ * @param out_jwt Where to write the signed token to.
+ * @param out_error If the daemon couldn't sign the token, the reason is written into this.
+ * @param out_answered Set to whether the daemon could be reached and answered at all.
+ * @return Whether the daemon signed the token.
+ */
+static bool forward_to_daemon(const string& socket_path, const option::Option* options, const jwt::builder& token, string& out_jwt, string& out_error, bool& out_answered)
+{
+	picojson::object claims;
+	for (const auto& claim : token.get_payload_claims())
+	{
+		claims[claim.first] = claim.second.to_json();
+	}
+
+	const string alg_name = selected_algorithm_name(options);
+
+	picojson::object request;
+	request["claims"] = picojson::value(claims);
+	request["alg"] = picojson::value(alg_name);
+	request["defaults"] = picojson::value(false);
+
+	// With a key directory the kid alone selects the daemon's key. HMAC secrets never leave the process, not even hashed:
+	// the returned token's signature is checked with the secret instead.
+	const bool hmac = alg_name.compare(0, 2, "HS") == 0;
+	const option::Option* key = options[KEY];
+	if (options[KEYS] == nullptr && !hmac && key != nullptr && key->arg != nullptr)
+	{
+		const string fingerprint = key_file_fingerprint(options, alg_name);
+		if (fingerprint.empty())
+		{
+			out_answered = false;
+			out_error = "The signing key couldn't be loaded.";
+			return false;
+		}
+		request["key"] = picojson::value(fingerprint);
+	}
 
-	PEM_write_PUBKEY(tmp_file, pkey);
+	const string kid = key_store::store::kid_of(token);
+	if (!kid.empty())
+	{
+		request["kid"] = picojson::value(kid);
+	}
 
-	std::fclose(tmp_file);
-	string out = read_file_as_text(tmp_path);
+	if (!client::sign(socket_path, picojson::value(request).serialize(), out_jwt, out_error, out_answered))
+	{
+		return false;
+	}
 
-	remove(tmp_path);
-	BIO_free(bio);
-	EVP_PKEY_free(pkey);
-	return out;
+	if (hmac && !signed_with_secret(out_jwt, alg_name, key->arg))
+	{
+		out_error = "Key mismatch: the daemon signs with another secret.";
+		return false;
+	}
+	return true;
 }
 
 /**
- * Finalizes the jwt generation procedure by printing out the
- * generated token to the console and eventually copying it to the clipboard.
- * @param jwt The generated jwt.
- * @param copy Should the generated jwt also be copied to the clipboard?
+ * Gets the SHA-256 digest of the passed data.
  */
-const void finalize(const string& jwt, const bool& copy)
+static string sha256(std::string_view data)
 {
-	cout << endl << jwt << endl;
-	if (copy)
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_len = 0;
+	if (!jwt::helper::hash(EVP_sha256(), data, digest, &digest_len))
 	{
-		clipboard::copy_txt(jwt);
+		throw std::runtime_error("SHA-256 failed");
+	}
+	return string(reinterpret_cast<const char*>(digest), digest_len);
+}
+
+/**
+ * Gets the id that tells a key's signatures apart in the signature memo (the SHA-256 digest of the key's public part).
+ * @param pkey The private key.
+ * @return The key id.
+ */
+static string memo_key_id(const std::shared_ptr<EVP_PKEY>& pkey)
+{
+	unsigned char* der = nullptr;
+	const int size = i2d_PUBKEY(pkey.get(), &der);
+	// OPENSSL_free is a macro, so it needs a wrapper to serve as deleter; frees the buffer even if sha256() throws
+	const std::unique_ptr<unsigned char, void (*)(unsigned char*)> der_guard(der, [](unsigned char* p) { OPENSSL_free(p); });
+	if (size <= 0)
+	{
+		throw std::runtime_error("the key's public part couldn't be encoded");
+	}
+	return sha256(std::string_view(reinterpret_cast<const char*>(der), static_cast<size_t>(size)));
+}
+
+/**
+ * Gets the factory that constructs a deterministic algorithm (RSASSA-PKCS1-v1_5 or EdDSA) for an already parsed key.
+ * @param memo The memo to remember the signatures in (nullptr disables memoization).
+ * @return The factory.
+ */
+template<typename T>
+static key_store::algorithm_factory memoizable_algorithm_factory(std::shared_ptr<jwt::algorithm::signature_memo> memo)
+{
+	return [memo](std::shared_ptr<EVP_PKEY> pkey)
+	{
+		const string key_id = memo ? memo_key_id(pkey) : string();
+		return signer::wrap(T(std::move(pkey)), memo, key_id);
+	};
+}
+
+/**
+ * Gets the factory that constructs an ECDSA algorithm for an already parsed EC key.
+ * @param pools Where to get the key's nonce precomputation pool from (nullptr disables precomputation).
+ * @return The factory.
+ */
+template<typename T>
+static key_store::algorithm_factory ecdsa_algorithm_factory(std::shared_ptr<nonce_pools::registry> pools)
+{
+	return [pools](std::shared_ptr<EVP_PKEY> pkey)
+	{
+		T alg(pkey);
+		if (pools)
+		{
+			alg.set_nonce_pool(pools->get(pkey));
+		}
+		return signer::wrap(std::move(alg));
+	};
+}
+
+/**
+ * Gets the factory that constructs the selected asymmetric algorithm for an already parsed private key.
+ * @param alg_name The upper-cased algorithm name (e.g. "RS256").
+ * @param pools Where ECDSA algorithms get their nonce precomputation pool from (nullptr disables precomputation).
+ * @param memo Where deterministic algorithms remember their signatures (nullptr disables memoization).
+ * @return The factory; an empty function if the algorithm isn't an asymmetric one.
+ */
+static key_store::algorithm_factory pkey_algorithm_factory(const string& alg_name, const std::shared_ptr<nonce_pools::registry>& pools, const std::shared_ptr<jwt::algorithm::signature_memo>& memo)
+{
+	if (alg_name == "RS256")
+	{
+		return memoizable_algorithm_factory<jwt::algorithm::rs256>(memo);
+	}
+
+	if (alg_name == "RS384")
+	{
+		return memoizable_algorithm_factory<jwt::algorithm::rs384>(memo);
+	}
+
+	if (alg_name == "RS512")
+	{
+		return memoizable_algorithm_factory<jwt::algorithm::rs512>(memo);
+	}
+
+	if (alg_name == "PS256")
+	{
+		return [](std::shared_ptr<EVP_PKEY> pkey) { return signer::wrap(jwt::algorithm::ps256(std::move(pkey))); };
+	}
+
+	if (alg_name == "PS384")
+	{
+		return [](std::shared_ptr<EVP_PKEY> pkey) { return signer::wrap(jwt::algorithm::ps384(std::move(pkey))); };
+	}
+
+	if (alg_name == "PS512")
+	{
+		return [](std::shared_ptr<EVP_PKEY> pkey) { return signer::wrap(jwt::algorithm::ps512(std::move(pkey))); };
+	}
+
+	if (alg_name == "ES256")
+	{
+		return ecdsa_algorithm_factory<jwt::algorithm::es256>(pools);
+	}
+
+	if (alg_name == "ES384")
+	{
+		return ecdsa_algorithm_factory<jwt::algorithm::es384>(pools);
+	}
+
+	if (alg_name == "ES512")
+	{
+		return ecdsa_algorithm_factory<jwt::algorithm::es512>(pools);
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	if (alg_name == "EDDSA")
+	{
+		// The curve is determined by the key (RFC 8037 uses "EdDSA" for both Ed25519 and Ed448).
+		return [memo](std::shared_ptr<EVP_PKEY> pkey) -> std::unique_ptr<signer::algorithm>
+		{
+			const string key_id = memo ? memo_key_id(pkey) : string();
+			if (pkey && EVP_PKEY_id(pkey.get()) == EVP_PKEY_ED448)
+			{
+				return signer::wrap(jwt::algorithm::ed448(std::move(pkey)), memo, key_id);
+			}
+			return signer::wrap(jwt::algorithm::ed25519(std::move(pkey)), memo, key_id);
+		};
+	}
+#endif
+
+	return nullptr;
+}
+
+/**
+ * Writes the signature memo's metrics as one human readable line.
+ * @param memo The memo.
+ * @param out Where to write the metrics to.
+ */
+static void report_signature_memo(const jwt::algorithm::signature_memo& memo, std::ostream& out)
+{
+	const auto s = memo.get_stats();
+	out << "Signature memo: " << s.hits << " hits, " << s.misses << " misses, " << s.evictions << " evictions, " << s.entries << '/' << s.capacity << " signatures remembered" << std::endl;
+}
+
+/**
+ * Creates the factory for the signing algorithm selected via the --alg, --key (or --keys) and --pw arguments.<p>
+ * Any key material is loaded and parsed once in here; the factory itself only constructs the jwt::algorithm instances.
+ * @param options The parsed jwtgen command line arguments.
+ * @param pools Where ECDSA algorithms get their nonce precomputation pool from (nullptr disables precomputation).
+ * @param memo Where deterministic algorithms remember their signatures (nullptr disables memoization).
+ * @param out_factory Where to write the created factory to.
+ * @param out_keys Where to write the key store to (only when signing with a directory of keys via --keys; otherwise left untouched).
+ * @param log Where to write warnings and errors to.
+ * @return 0 if the factory was created successfully; 2 if the passed arguments are invalid.
+ */
+static int create_signer_factory(const option::Option* options, const std::shared_ptr<nonce_pools::registry>& pools, const std::shared_ptr<jwt::algorithm::signature_memo>& memo, signer::factory& out_factory, std::shared_ptr<key_store::store>& out_keys, std::ostream& log)
+{
+	using option::Option;
+
+	const Option* key = options[KEY];
+	const Option* keys = options[KEYS];
+
+	if (keys != nullptr && keys->last()->arg != nullptr && key != nullptr)
+	{
+		log << "\nERROR: Please pass either a single signing key (--key) or a key directory (--keys), not both.";
+		return 2;
+	}
+
+	const Option* pw = options[PW];
+	string pw_str;
+
+	if (pw != nullptr)
+	{
+		if (pw->count() > 1)
+		{
+			log << "\nERROR: You passed more than one private key password. Only one --pw argument per jwt is allowed!\n";
+			return 2;
+		}
+		pw_str = string(pw->arg);
+	}
+
+	if (keys != nullptr && keys->last()->arg != nullptr)
+	{
+		const string alg_name = selected_algorithm_name(options);
+		const key_store::algorithm_factory make_algorithm = pkey_algorithm_factory(alg_name, pools, memo);
+		if (!make_algorithm)
+		{
+			log << "\nERROR: Key directories (--keys) can only be used with an asymmetric algorithm (please specify one via --alg).";
+			return 2;
+		}
+
+		const auto store = std::make_shared<key_store::store>(alg_name, keys->last()->arg, pw_str, make_algorithm);
+		try
+		{
+			if (store->reload(log) == 0)
+			{
+				log << "\nERROR: The specified key directory doesn't contain any usable " << alg_name << " signing keys: " << keys->last()->arg;
+				return 2;
+			}
+		}
+		catch (const std::exception& e)
+		{
+			log << "\nERROR: The specified key directory couldn't be read: " << e.what();
+			return 2;
+		}
+
+		out_keys = store;
+		out_factory = [store] { return std::unique_ptr<signer::algorithm>(new key_store::algorithm(store)); };
+		return 0;
+	}
+
+	if (key == nullptr || key->arg == nullptr)
+	{
+		log << "WARNING: No signing key specified; encoding jwt without signing it. Are you sure that this is what you want?";
+		out_factory = [] { return signer::wrap(jwt::algorithm::none()); };
+		return 0;
+	}
+
+	// HMAC isn't memoized: the memo lookup costs about as much as the HMAC itself, and the memo would have to be keyed by the secret
+	const string secret(key->arg);
+
+	const Option* alg = options[ALG];
+	if (alg == nullptr)
+	{
+		log << "WARNING: You specified a secret HMACSHA signing key but did not specify which HMACSHA variant to use; used default value of HS256.\nIf you passed an RSA key file path into the key argument: please also specify the algorithm to use (otherwise the path string itself is used as a secret for the HS256 algo).";
+		out_factory = [secret] { return signer::wrap(jwt::algorithm::hs256{ secret }); };
+		return 0;
+	}
+
+	const string alg_name = selected_algorithm_name(options);
+	if (alg_name.empty())
+	{
+		log << "ERROR: The passed algorithm name argument is empty.";
+		return 2;
+	}
+
+	if (alg_name == "HS256")
+	{
+		out_factory = [secret] { return signer::wrap(jwt::algorithm::hs256{ secret }); };
+		return 0;
+	}
+
+	if (alg_name == "HS384")
+	{
+		out_factory = [secret] { return signer::wrap(jwt::algorithm::hs384{ secret }); };
+		return 0;
+	}
+
+	if (alg_name == "HS512")
+	{
+		out_factory = [secret] { return signer::wrap(jwt::algorithm::hs512{ secret }); };
+		return 0;
+	}
+
+	const key_store::algorithm_factory make_algorithm = pkey_algorithm_factory(alg_name, pools, memo);
+	if (!make_algorithm)
+	{
+		log << "ERROR: The passed algorithm type \"" << alg_name << "\"is not valid";
+		return 2;
+	}
+
+	const string pem = read_file_as_text(key->arg);
+	if (pem.empty())
+	{
+		log << "ERROR: The specified signing key file does not exist or couldn't be read: " << key->arg;
+		return 2;
+	}
+
+	// Parse the private key once; every algorithm instance created by the factory shares it.
+	const std::shared_ptr<EVP_PKEY> pkey = key_store::parse_private_key(pem, pw_str);
+	if (!pkey)
+	{
+		log << "\nERROR: The specified signing key file couldn't be loaded as a private key in PEM or DER format (wrong password?): " << key->arg;
+		return 2;
+	}
+
+	try
+	{
+		make_algorithm(pkey);
+	}
+	catch (const std::exception& e)
+	{
+		log << "\nERROR: The specified signing key can't be used with " << alg_name << " (" << e.what() << "): " << key->arg;
+		return 2;
 	}
+
+	out_factory = [pkey, make_algorithm] { return make_algorithm(pkey); };
+	return 0;
 }
 
 /**
@@ -190,14 +623,14 @@ int main(int argc, char** argv)
 	using option::Option;
 	using option::Parser;
 
-	const Stats stats(usage, argc, argv);
+	// GNU-style parsing, so that options may follow the "serve" command.
+	const Stats stats(true, usage, argc, argv);
 
-	Option* const buffer = new Option[stats.buffer_max];
-	Option* const options = new Option[stats.options_max];
+	vector<Option> buffer(stats.buffer_max);
+	vector<Option> options_vector(stats.options_max);
+	Option* const options = options_vector.data();
 
-	Parser parser(usage, argc, argv, options, buffer);
-
-	delete[] buffer, options;
+	Parser parser(true, usage, argc, argv, options, buffer.data());
 
 	if (parser.error())
 	{
@@ -288,6 +721,17 @@ int main(int argc, char** argv)
 		token.set_not_before(string_to_time_point(nbf->arg));
 	}
 
+	const Option* kid = options[KID];
+	if (kid != nullptr)
+	{
+		if (kid->count() > 1)
+		{
+			cout << "\nERROR: You passed more than one key id. Only one --kid per jwt is allowed!\n";
+			return 2;
+		}
+		token.set_key_id(kid->arg);
+	}
+
 	for (const Option* opt = options[CLAIM]; opt; opt = opt->next())
 	{
 		const string& claim(opt->arg);
@@ -314,91 +758,185 @@ int main(int argc, char** argv)
 	}
 
 	const bool& copy = options[COPY];
-	const Option* key = options[KEY];
+	const bool batch_mode = options[BATCH];
+	const bool serve_mode = parser.nonOptionsCount() > 0 && string(parser.nonOption(0)) == "serve";
 
-	if (key == nullptr || key->arg == nullptr)
-	{
-		cout << "WARNING: No signing key specified; encoding jwt without signing it. Are you sure that this is what you want?";
-		finalize(token.sign(jwt::algorithm::none()), copy);
-		return 0;
-	}
-
-	const Option* alg = options[ALG];
-	if (alg == nullptr)
-	{
-		cout << "WARNING: You specified a secret HMACSHA signing key but did not specify which HMACSHA variant to use; used default value of HS256.\nIf you passed an RSA key file path into the key argument: please also specify the algorithm to use (otherwise the path string itself is used as a secret for the HS256 algo).";
-		finalize(token.sign(jwt::algorithm::hs256{ key->arg }), copy);
-		return 0;
-	}
+	// In batch mode stdout only contains the generated tokens.
+	std::ostream& log = batch_mode || serve_mode ? std::cerr : cout;
 
-	string alg_name(alg->arg);
-	for (char& c : alg_name)
-	{
-		c = toupper(c);
-	}
-	if (alg_name.empty())
+	size_t thread_count = std::thread::hardware_concurrency();
+	const Option* threads = options[THREADS];
+	if (threads != nullptr && threads->last()->arg != nullptr)
 	{
-		cout << "ERROR: The passed algorithm name argument is empty.";
-		return 2;
+		thread_count = std::strtoul(threads->last()->arg, nullptr, 10);
 	}
 
-	if (alg_name == "HS256")
-	{
-		finalize(token.sign(jwt::algorithm::hs256{ key->arg }), copy);
-		return 0;
-	}
+	const Option* connect = options[CONNECT];
+	const char* daemon_socket = connect != nullptr && connect->last()->arg != nullptr ? connect->last()->arg : std::getenv("JWTGEN_SOCKET");
 
-	if (alg_name == "HS384")
+	if (daemon_socket != nullptr && *daemon_socket != '\0' && !batch_mode && !serve_mode)
 	{
-		finalize(token.sign(jwt::algorithm::hs384{ key->arg }), copy);
-		return 0;
+		string jwt, error;
+		bool answered = false;
+		if (forward_to_daemon(daemon_socket, options, token, jwt, error, answered))
+		{
+			finalize(jwt, copy);
+			return 0;
+		}
+		// A daemon that's configured (even if only via JWTGEN_SOCKET) but not reachable is always worth a warning;
+		// that a reachable daemon uses another algorithm or key is only reported if it was asked for explicitly.
+		if (connect != nullptr || !answered)
+		{
+			log << "WARNING: The signing daemon at " << daemon_socket << " couldn't sign the token (" << error << "); signing in-process instead.\n";
+		}
 	}
 
-	if (alg_name == "HS512")
+	std::shared_ptr<nonce_pools::registry> pools;
+	const Option* nonce_pool = options[NONCE_POOL];
+	if (nonce_pool != nullptr && nonce_pool->last()->arg != nullptr)
 	{
-		finalize(token.sign(jwt::algorithm::hs512{ key->arg }), copy);
-		return 0;
+		const size_t capacity = std::strtoul(nonce_pool->last()->arg, nullptr, 10);
+		const string alg_name = selected_algorithm_name(options);
+		if (alg_name != "ES256" && alg_name != "ES384" && alg_name != "ES512")
+		{
+			log << "WARNING: The --nonce-pool argument only applies to the ES256, ES384 and ES512 algorithms; ignored.\n";
+		}
+		else if (!batch_mode && !serve_mode)
+		{
+			log << "WARNING: The --nonce-pool argument only applies to batch and serve mode; ignored.\n";
+		}
+		else if (capacity > 0)
+		{
+			size_t refill_threads = 1;
+			const Option* nonce_pool_threads = options[NONCE_POOL_THREADS];
+			if (nonce_pool_threads != nullptr && nonce_pool_threads->last()->arg != nullptr)
+			{
+				refill_threads = std::max<size_t>(std::strtoul(nonce_pool_threads->last()->arg, nullptr, 10), 1);
+			}
+			pools = std::make_shared<nonce_pools::registry>(capacity, refill_threads);
+		}
 	}
 
-	const string& pem = read_file_as_text(key->arg);
-	const Option* pw = options[PW];
-	string pw_str;
-
-	if (pw != nullptr)
+	std::shared_ptr<jwt::algorithm::signature_memo> memo;
+	const Option* sign_memo = options[SIGN_MEMO];
+	if (sign_memo != nullptr && sign_memo->last()->arg != nullptr)
 	{
-		if (pw->count() > 1)
+		const size_t capacity = std::strtoul(sign_memo->last()->arg, nullptr, 10);
+		const string alg_name = selected_algorithm_name(options);
+		if (alg_name != "RS256" && alg_name != "RS384" && alg_name != "RS512" && alg_name != "EDDSA")
 		{
-			cout << "\nERROR: You passed more than one RSA key password. Only one --pw argument per jwt is allowed!\n";
-			return 2;
+			log << "WARNING: The --sign-memo argument only applies to the RS256, RS384, RS512 and EdDSA algorithms; ignored.\n";
+		}
+		else if (!batch_mode && !serve_mode)
+		{
+			log << "WARNING: The --sign-memo argument only applies to batch and serve mode; ignored.\n";
+		}
+		else if (capacity > 0)
+		{
+			memo = std::make_shared<jwt::algorithm::signature_memo>(capacity);
 		}
-		pw_str = string(pw->arg);
 	}
 
-	if (pem.empty())
+	signer::factory factory;
+	std::shared_ptr<key_store::store> keys;
+	const int result = create_signer_factory(options, pools, memo, factory, keys, log);
+	if (result != 0)
 	{
-		cout << "ERROR: The specified signing key file does not exist or couldn't be read: " << key->arg;
-		return 2;
+		return result;
 	}
 
-	if (alg_name == "RS256")
+	try
 	{
-		finalize(token.sign(jwt::algorithm::rs256(extract_pub_key_from_private_pem(pem), pem, "", pw_str)), copy);
-		return 0;
-	}
+		if (serve_mode)
+		{
+			const Option* socket = options[SOCKET];
+			if (socket == nullptr || socket->last()->arg == nullptr)
+			{
+				log << "\nERROR: Serve mode requires the --socket=PATH argument." << endl;
+				return 2;
+			}
+			log << endl;
+
+			server::config cfg;
+			cfg.prototype = token;
+			cfg.stamp_iat = options[IAT] == nullptr;
+#if __linux__
+			// Pick up rotated keys without restarting the daemon.
+			std::unique_ptr<key_store::watcher> key_watcher;
+			if (keys)
+			{
+				string error;
+				key_watcher.reset(new key_store::watcher(keys, std::cerr));
+				if (!key_watcher->start(error))
+				{
+					log << "WARNING: Key rotation is disabled; the key directory can't be watched (" << error << ")." << endl;
+					key_watcher.reset();
+				}
+			}
+#endif
 
-	if (alg_name == "RS384")
-	{
-		finalize(token.sign(jwt::algorithm::rs384(extract_pub_key_from_private_pem(pem), pem, "", pw_str)), copy);
-		return 0;
-	}
+			if (keys)
+			{
+				cfg.resolve_key = [keys](const jwt::builder& t)
+				{
+					server::signing_key key;
+					const auto e = keys->find(key_store::store::kid_of(t));
+					if (e)
+					{
+						key.fingerprint = std::shared_ptr<const string>(e, &e->fingerprint);
+						key.alg = e->alg;
+					}
+					return key;
+				};
+				// Idle threads mustn't keep replaced key sets alive
+				cfg.on_idle = key_store::store::release_thread_cache;
+			}
+			else
+			{
+				const string fingerprint = key_file_fingerprint(options, selected_algorithm_name(options));
+				const auto key = server::signing_key{ fingerprint.empty() ? nullptr : std::make_shared<const string>(fingerprint), nullptr };
+				cfg.resolve_key = [key](const jwt::builder&) { return key; };
+			}
+
+			const int served = server::run(std::move(cfg), factory, socket->last()->arg, thread_count);
+			if (pools)
+			{
+				pools->report(log);
+			}
+			if (memo)
+			{
+				report_signature_memo(*memo, log);
+			}
+			return served;
+		}
 
-	if (alg_name == "RS512")
+		if (batch_mode)
+		{
+			if (copy)
+			{
+				log << "\nWARNING: The --copy argument is ignored in batch mode.";
+			}
+			log << endl;
+			const int signed_all = batch::run(token, factory, thread_count, options[BATCH].last()->arg);
+			if (pools)
+			{
+				pools->report(log);
+			}
+			if (memo)
+			{
+				report_signature_memo(*memo, log);
+			}
+			return signed_all;
+		}
+
+		finalize(factory()->sign(token), copy);
+	}
+	catch (const std::exception& e)
 	{
-		finalize(token.sign(jwt::algorithm::rs512(extract_pub_key_from_private_pem(pem), pem, "", pw_str)), copy);
-		return 0;
+		log << "\nERROR: Failed to sign the jwt: " << e.what() << endl;
+		return 2;
 	}
 
-	cout << "ERROR: The passed algorithm type \"" << alg_name << "\"is not valid";
-	return 2;
+	return 0;
 }
 
@@ -0,0 +1,183 @@
+/*
+   Checks that the SIMD base64/base64url kernels produce exactly what the scalar table path produces:
+   every byte value at every input position, every input length up to several SIMD blocks (so every length mod 3 and mod 4),
+   and for decoding every byte value (valid or not) at every character position.<p>
+   The kernels are picked at runtime, so this covers the best instruction set of the machine it runs on,
+   plus the narrower kernels that handle what's left after the wide ones.
+*/
+
+#include <array>
+#include <string>
+#include <cstdio>
+#include <stdexcept>
+#include "jwt-cpp/base.h"
+
+using namespace std;
+
+/**
+ * Same characters as alphabet T, but in another array: jwt::base only uses its SIMD kernels for the built-in alphabet arrays,
+ * so this one always takes the scalar table path.
+ */
+template <typename T>
+struct scalar
+{
+	static const array<char, 64>& data()
+	{
+		static const array<char, 64> copy = T::data();
+		return copy;
+	}
+
+	static const string& fill()
+	{
+		return T::fill();
+	}
+};
+
+static size_t failures = 0;
+
+/**
+ * Reports a mismatch between the SIMD and the scalar path.
+ * @param what What was compared.
+ * @param input The input that produced different results.
+ */
+static void fail(const char* what, const string& input)
+{
+	if (++failures <= 10)
+	{
+		fprintf(stderr, "FAIL: %s differs for a %zu byte input:", what, input.size());
+		for (unsigned char c : input)
+		{
+			fprintf(stderr, " %02x", c);
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+/**
+ * Decodes via a decode function, mapping "invalid input" to a marker that can't be a decoding result of the same input.
+ */
+template <typename F>
+static string try_decode(F decode, const string& input)
+{
+	try
+	{
+		return "ok:" + decode(input);
+	}
+	catch (const runtime_error&)
+	{
+		return "invalid";
+	}
+}
+
+/**
+ * Compares encoding and decoding of one input via both paths.
+ * @param bin The binary input.
+ */
+template <typename T>
+static void check_encode(const string& bin)
+{
+	using jwt::base;
+	const string padded = base::encode<T>(bin);
+	const string unpadded = base::encode_unpadded<T>(bin);
+	if (padded != base::encode<scalar<T>>(bin))
+	{
+		fail("encode", bin);
+	}
+	if (unpadded != base::encode_unpadded<scalar<T>>(bin))
+	{
+		fail("encode_unpadded", bin);
+	}
+	if (base::decode<T>(padded) != bin || base::decode_unpadded<T>(unpadded) != bin)
+	{
+		fail("round trip", bin);
+	}
+}
+
+/**
+ * Compares decoding of one (possibly invalid) input via both paths.
+ * @param text The encoded input.
+ */
+template <typename T>
+static void check_decode(const string& text)
+{
+	using jwt::base;
+	if (try_decode([](const string& s) { return base::decode_unpadded<T>(s); }, text) != try_decode([](const string& s) { return base::decode_unpadded<scalar<T>>(s); }, text))
+	{
+		fail("decode_unpadded", text);
+	}
+	if (try_decode([](const string& s) { return base::decode<T>(s); }, text) != try_decode([](const string& s) { return base::decode<scalar<T>>(s); }, text))
+	{
+		fail("decode", text);
+	}
+}
+
+/**
+ * Runs all checks for an alphabet.
+ * @param max_size Largest binary input; several of the widest SIMD blocks (24 bytes in, 32 characters out).
+ */
+template <typename T>
+static void check_alphabet(size_t max_size)
+{
+	for (size_t size = 0; size <= max_size; size++)
+	{
+		// With every shift, each position sees another byte value; 256 shifts give every value at every position
+		for (unsigned shift = 0; shift < 256; shift++)
+		{
+			string bin(size, '\0');
+			for (size_t i = 0; i < size; i++)
+			{
+				bin[i] = (char)((i * 167 + shift) & 0xFF);
+			}
+			check_encode<T>(bin);
+		}
+
+		// Decoding every byte value at every position is quadratic, so it runs for all short inputs and for 12 consecutive sizes
+		// (every length mod 3 and mod 4) that span three AVX2 blocks, an SSE block and the scalar tail
+		if (size > 24 && (size < 72 || size >= 84))
+		{
+			continue;
+		}
+		string bin(size, '\0');
+		for (size_t i = 0; i < size; i++)
+		{
+			bin[i] = (char)(i * 89 + 7);
+		}
+		const string unpadded = jwt::base::encode_unpadded<T>(bin);
+		const string padded = jwt::base::encode<T>(bin);
+		check_decode<T>(unpadded);
+		check_decode<T>(padded);
+		for (size_t pos = 0; pos < padded.size(); pos++)
+		{
+			// The padded form only differs in its fill, so only its last quadruple gets modified
+			const bool modify_padded = pos + 4 * T::fill().size() >= padded.size();
+			string modified = unpadded, modified_padded = padded;
+			for (unsigned c = 0; c < 256; c++)
+			{
+				if (pos < unpadded.size())
+				{
+					modified[pos] = (char)c;
+					check_decode<T>(modified);
+				}
+				if (modify_padded)
+				{
+					modified_padded[pos] = (char)c;
+					check_decode<T>(modified_padded);
+				}
+			}
+		}
+	}
+}
+
+int main()
+{
+	check_alphabet<jwt::alphabet::base64>(100);
+	check_alphabet<jwt::alphabet::base64url>(100);
+
+	if (failures != 0)
+	{
+		fprintf(stderr, "%zu mismatches between the SIMD and the scalar base64 paths\n", failures);
+		return 1;
+	}
+	printf("SIMD and scalar base64 paths agree\n");
+	return 0;
+}
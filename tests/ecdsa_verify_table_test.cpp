@@ -0,0 +1,135 @@
+/*
+   Checks jwt::algorithm::ecdsa::precompute_verification: with a verification table of any window size, ES256, ES384 and ES512
+   accept exactly the signatures that plain verification (ECDSA_do_verify) accepts, and reject tampered inputs and signatures,
+   including r and s values outside of [1, order).
+*/
+
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include "jwt-cpp/jwt.h"
+
+using namespace std;
+
+static size_t failures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			fprintf(stderr, "FAIL (line %d): %s\n", __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (false)
+
+static shared_ptr<EVP_PKEY> generate_key(int nid)
+{
+	unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx(EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr), EVP_PKEY_CTX_free);
+	EVP_PKEY* key = nullptr;
+	if (!ctx || EVP_PKEY_keygen_init(ctx.get()) <= 0 || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx.get(), nid) <= 0 || EVP_PKEY_keygen(ctx.get(), &key) <= 0)
+	{
+		return nullptr;
+	}
+	return shared_ptr<EVP_PKEY>(key, EVP_PKEY_free);
+}
+
+/**
+ * Verifies a signature.
+ * @return Whether the signature was accepted.
+ */
+template <typename T>
+static bool accepted(const T& alg, const string& data, const string& signature)
+{
+	try
+	{
+		alg.verify(data, signature);
+		return true;
+	}
+	catch (const jwt::signature_verification_exception&)
+	{
+		return false;
+	}
+}
+
+/**
+ * Compares verification with and without a table for a curve.
+ * @param nid The curve NID.
+ */
+template <typename T>
+static void check_algorithm(int nid)
+{
+	const auto key = generate_key(nid);
+	const auto other_key = generate_key(nid);
+	CHECK(key && other_key);
+	if (!key || !other_key)
+	{
+		return;
+	}
+
+	const T plain(key);
+	CHECK(plain.verification_table_size() == 0);
+	for (unsigned int window_bits : { 1, 4, 6 })
+	{
+		T with_table(key);
+		const size_t size = with_table.precompute_verification(window_bits);
+		CHECK(size > 0 && with_table.verification_table_size() == size);
+
+		// Copies share the table
+		const T copy = with_table;
+		CHECK(copy.verification_table_size() == size);
+
+		for (int i = 0; i < 20; i++)
+		{
+			const string data = "header.payload-" + to_string(i);
+			const string signature = plain.sign(data);
+			CHECK(accepted(plain, data, signature));
+			CHECK(accepted(with_table, data, signature));
+			CHECK(accepted(copy, data, signature));
+
+			CHECK(!accepted(with_table, data + "x", signature));
+			CHECK(!accepted(with_table, data, T(other_key).sign(data)));
+
+			string tampered = signature;
+			tampered[i % tampered.size()] ^= 0x01;
+			CHECK(accepted(plain, data, tampered) == accepted(with_table, data, tampered));
+		}
+
+		// r and s outside of [1, order)
+		const string data = "header.payload";
+		const size_t half = plain.sign(data).size() / 2;
+		CHECK(!accepted(with_table, data, string(2 * half, '\0')));
+		CHECK(!accepted(with_table, data, string(2 * half, '\xff')));
+		const string signature = plain.sign(data);
+		CHECK(!accepted(with_table, data, signature.substr(0, half) + string(half, '\0')));
+		CHECK(!accepted(with_table, data, string(half, '\0') + signature.substr(half)));
+	}
+
+	bool thrown = false;
+	try
+	{
+		T(key).precompute_verification(13);
+	}
+	catch (const jwt::ecdsa_exception&)
+	{
+		thrown = true;
+	}
+	CHECK(thrown);
+}
+
+int main()
+{
+	check_algorithm<jwt::algorithm::es256>(NID_X9_62_prime256v1);
+	check_algorithm<jwt::algorithm::es384>(NID_secp384r1);
+	check_algorithm<jwt::algorithm::es512>(NID_secp521r1);
+
+	if (failures != 0)
+	{
+		fprintf(stderr, "%zu ECDSA verification table checks failed\n", failures);
+		return 1;
+	}
+	printf("ECDSA verification table checks passed\n");
+	return 0;
+}
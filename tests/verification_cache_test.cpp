@@ -0,0 +1,210 @@
+/*
+   Checks jwt::verification_cache: hits, misses, LRU eviction, expiry at the token's exp claim, invalidate() and
+   set_verifier(), that the capacity is never exceeded, and the keyed hash (the cache uses SipHash-1-3; the implementation
+   is checked against the reference SipHash-2-4 test vectors).
+*/
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include "jwt-cpp/jwt.h"
+
+using namespace std;
+
+static size_t failures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			fprintf(stderr, "FAIL (line %d): %s\n", __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (false)
+
+/**
+ * Clock whose time is set by the test (copies share the time).
+ */
+struct test_clock
+{
+	static jwt::date time;
+
+	jwt::date now() const
+	{
+		return time;
+	}
+};
+
+jwt::date test_clock::time = chrono::system_clock::from_time_t(1700000000);
+
+/**
+ * Creates a token that expires a minute from the test clock's current time.
+ */
+static string make_token(const string& subject, const string& secret = "secret")
+{
+	return jwt::create()
+		.set_subject(subject)
+		.set_expires_at(test_clock::time + chrono::seconds(60))
+		.sign(jwt::algorithm::hs256(secret));
+}
+
+static jwt::verifier<test_clock> make_verifier(const string& secret = "secret")
+{
+	return jwt::verify(test_clock{}).allow_algorithm(jwt::algorithm::hs256(secret));
+}
+
+/**
+ * Verifies a token through the cache.
+ * @return Whether the token was accepted.
+ */
+static bool accepted(jwt::verification_cache<test_clock>& cache, const string& token)
+{
+	try
+	{
+		return cache.verify(token) != nullptr;
+	}
+	catch (const exception&)
+	{
+		return false;
+	}
+}
+
+static void test_siphash()
+{
+	const uint64_t key[2] = { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL };
+	string message;
+	for (char c = 0; c < 15; c++)
+	{
+		message += c;
+	}
+	auto siphash_2_4 = [&](const string& data) { return jwt::helper::siphash<2, 4>(key, data); };
+	CHECK(siphash_2_4("") == 0x726fdb47dd0e0e31ULL);
+	CHECK(siphash_2_4(message.substr(0, 8)) == 0x93f5f5799a932462ULL);
+	CHECK(siphash_2_4(message) == 0xa129ca6149be45e5ULL);
+}
+
+static void test_hit_miss_eviction()
+{
+	jwt::verification_cache<test_clock> cache(make_verifier(), test_clock{}, 4, 1);
+	vector<string> tokens;
+	for (int i = 0; i < 5; i++)
+	{
+		tokens.push_back(make_token("user-" + to_string(i)));
+	}
+
+	const auto first = cache.verify(tokens[0]);
+	CHECK(cache.get_stats().misses == 1 && cache.get_stats().hits == 0);
+	CHECK(cache.verify(tokens[0]) == first);
+	CHECK(cache.get_stats().hits == 1);
+
+	for (int i = 1; i < 4; i++)
+	{
+		cache.verify(tokens[i]);
+	}
+	CHECK(cache.get_stats().entries == 4);
+	CHECK(cache.get_stats().evictions == 0);
+
+	// tokens[0] is the least recently used one now
+	cache.verify(tokens[4]);
+	auto stats = cache.get_stats();
+	CHECK(stats.entries == 4 && stats.evictions == 1);
+	CHECK(stats.memory_usage > 0);
+	cache.verify(tokens[4]);
+	CHECK(cache.get_stats().hits == 2);
+	CHECK(cache.verify(tokens[0]) != first);
+	CHECK(cache.get_stats().misses == 6);
+
+	// Rejected tokens are never cached
+	const string tampered = tokens[1].substr(0, tokens[1].size() - 6) + "AAAAAA";
+	CHECK(!accepted(cache, tampered));
+	CHECK(!accepted(cache, tampered));
+	stats = cache.get_stats();
+	CHECK(stats.misses == 8 && stats.entries == 4);
+}
+
+static void test_expiry()
+{
+	const jwt::date start = test_clock::time;
+	jwt::verification_cache<test_clock> cache(make_verifier(), test_clock{}, 8, 2);
+	const string token = make_token("expiring");
+	CHECK(accepted(cache, token));
+	CHECK(accepted(cache, token));
+	CHECK(cache.get_stats().hits == 1);
+
+	test_clock::time = start + chrono::seconds(61);
+	CHECK(!accepted(cache, token));
+	const auto stats = cache.get_stats();
+	CHECK(stats.expirations == 1 && stats.entries == 0 && stats.hits == 1);
+	test_clock::time = start;
+}
+
+static void test_invalidation()
+{
+	jwt::verification_cache<test_clock> cache(make_verifier(), test_clock{}, 8, 2);
+	const string token = make_token("rotating");
+	CHECK(accepted(cache, token));
+	CHECK(cache.get_stats().entries == 1);
+
+	cache.invalidate();
+	auto stats = cache.get_stats();
+	CHECK(stats.entries == 0 && stats.invalidations == 1 && stats.memory_usage == 0);
+	CHECK(accepted(cache, token));
+	CHECK(cache.get_stats().misses == 2);
+
+	// A cached acceptance must not outlive the verifier that produced it
+	cache.set_verifier(make_verifier("rotated"));
+	CHECK(!accepted(cache, token));
+	CHECK(accepted(cache, make_token("rotating", "rotated")));
+	stats = cache.get_stats();
+	CHECK(stats.invalidations == 2 && stats.entries == 1);
+}
+
+static void test_capacity()
+{
+	// Rounded down to a multiple of the shard count, never up
+	jwt::verification_cache<test_clock> rounded(make_verifier(), test_clock{}, 10, 4);
+	CHECK(rounded.get_stats().capacity == 8);
+	for (int i = 0; i < 200; i++)
+	{
+		rounded.verify(make_token("many-" + to_string(i)));
+		CHECK(rounded.get_stats().entries <= 8);
+	}
+
+	// Fewer entries than shards: one entry per shard
+	jwt::verification_cache<test_clock> tiny(make_verifier(), test_clock{}, 3, 16);
+	CHECK(tiny.get_stats().capacity == 3);
+	for (int i = 0; i < 50; i++)
+	{
+		tiny.verify(make_token("few-" + to_string(i)));
+		CHECK(tiny.get_stats().entries <= 3);
+	}
+
+	bool thrown = false;
+	try
+	{
+		jwt::verification_cache<test_clock> empty(make_verifier(), test_clock{}, 0, 4);
+	}
+	catch (const invalid_argument&)
+	{
+		thrown = true;
+	}
+	CHECK(thrown);
+}
+
+int main()
+{
+	test_siphash();
+	test_hit_miss_eviction();
+	test_expiry();
+	test_invalidation();
+	test_capacity();
+
+	if (failures != 0)
+	{
+		fprintf(stderr, "%zu verification cache checks failed\n", failures);
+		return 1;
+	}
+	printf("verification cache checks passed\n");
+	return 0;
+}
@@ -0,0 +1,95 @@
+/*
+   Checks that jwt::verifier reports time claims (exp, iat, nbf) that aren't integer timestamps as claim type errors, the same way
+   with and without compile() and with the claims checked before or after the signature, and that numeric time claims are still checked.
+*/
+
+#include <string>
+#include <cstdio>
+#include "jwt-cpp/jwt.h"
+
+using namespace std;
+
+static size_t failures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			fprintf(stderr, "FAIL (line %d): %s\n", __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (false)
+
+/**
+ * Verifies a token.
+ * @return The verification error (without the "token verification failed: " prefix); "bad_cast" if std::bad_cast escaped;
+ *         an empty string if the token was accepted.
+ */
+static string verify_error(const jwt::verifier<jwt::default_clock>& verifier, const string& token)
+{
+	try
+	{
+		verifier.verify(jwt::decode(token));
+		return "";
+	}
+	catch (const jwt::token_verification_exception& e)
+	{
+		const string message = e.what();
+		return message.substr(message.rfind(": ") == string::npos ? 0 : message.rfind(": ") + 2);
+	}
+	catch (const bad_cast&)
+	{
+		return "bad_cast";
+	}
+}
+
+static string make_token(const string& name, const picojson::value& value)
+{
+	return jwt::create().set_subject("user").set_payload_claim(name, jwt::claim(value)).sign(jwt::algorithm::hs256("secret"));
+}
+
+static void test_time_claim_types(bool compiled, bool claims_first)
+{
+	auto verifier = jwt::verify().allow_algorithm(jwt::algorithm::hs256("secret")).with_subject("user").check_claims_first(claims_first);
+	if (compiled)
+	{
+		verifier.compile();
+	}
+
+	const int64_t now = chrono::system_clock::to_time_t(chrono::system_clock::now());
+	for (const string name : { "exp", "iat", "nbf" })
+	{
+		const string mismatch = "claim " + name + " type mismatch";
+		CHECK(verify_error(verifier, make_token(name, picojson::value("tomorrow"))) == mismatch);
+		CHECK(verify_error(verifier, make_token(name, picojson::value(picojson::object{ { "seconds", picojson::value(int64_t(60)) } }))) == mismatch);
+		CHECK(verify_error(verifier, make_token(name, picojson::value(picojson::array{ picojson::value(now) }))) == mismatch);
+		CHECK(verify_error(verifier, make_token(name, picojson::value(1700000000.5))) == mismatch);
+		CHECK(verify_error(verifier, make_token(name, picojson::value(true))) == mismatch);
+		CHECK(verify_error(verifier, make_token(name, picojson::value())) == mismatch);
+	}
+
+	CHECK(verify_error(verifier, make_token("exp", picojson::value(now + 60))).empty());
+	CHECK(verify_error(verifier, make_token("exp", picojson::value(now - 60))) == "token expired");
+	CHECK(verify_error(verifier, make_token("iat", picojson::value(now))).empty());
+	CHECK(verify_error(verifier, make_token("nbf", picojson::value(now + 60))) == "token expired");
+}
+
+int main()
+{
+	for (bool compiled : { false, true })
+	{
+		for (bool claims_first : { false, true })
+		{
+			test_time_claim_types(compiled, claims_first);
+		}
+	}
+
+	if (failures != 0)
+	{
+		fprintf(stderr, "%zu verifier checks failed\n", failures);
+		return 1;
+	}
+	printf("verifier checks passed\n");
+	return 0;
+}